@@ -0,0 +1,193 @@
+#include "affinitymatrix.h"
+
+#include <algorithm>
+#include <QtMath>
+
+#include "parallelfor.h"
+
+namespace
+{
+	template <typename T>
+	void compactRows(T* data, int size, const QVector<int>& keptIndices)
+	{
+		// rows move towards the front only, so an in-place forward copy is safe
+		int keptCount = keptIndices.size();
+		for (int newRow = 0; newRow < keptCount; ++newRow)
+		{
+			const T* source = data + qint64(keptIndices[newRow]) * size;
+			T* target = data + qint64(newRow) * keptCount;
+
+			for (int newColumn = 0; newColumn < keptCount; ++newColumn)
+			{
+				target[newColumn] = source[keptIndices[newColumn]];
+			}
+		}
+	}
+}
+
+const int AffinityMatrix::ROW_BLOCK_SIZE;
+const int AffinityMatrix::COLUMN_BLOCK_SIZE;
+const qint64 AffinityMatrix::MAXIMAL_BYTES;
+
+qint64 AffinityMatrix::requiredBytes(int size, Precision precision)
+{
+	qint64 elementSize = precision == HALF_PRECISION ? sizeof(qfloat16) : sizeof(float);
+	return qint64(size) * size * elementSize;
+}
+
+bool AffinityMatrix::fits(int size, Precision precision, qint64 budgetBytes)
+{
+	return size > 0 && qint64(size) * size <= INT_MAX
+		&& requiredBytes(size, precision) <= qMin(budgetBytes, MAXIMAL_BYTES);
+}
+
+void AffinityMatrix::build(const float* const* channels, int channelCount, int size,
+	double weightRatioSquare, Precision precision, const QAtomicInt* cancellation)
+{
+	clear();
+	n = size;
+	storagePrecision = precision;
+
+	float* singleData = nullptr;
+	qfloat16* halfData = nullptr;
+	if (precision == HALF_PRECISION)
+	{
+		halves.resize(n * n);
+		halfData = halves.data();
+	}
+	else
+	{
+		singles.resize(n * n);
+		singleData = singles.data();
+	}
+
+	const auto& buildRows = [&](int begin, int end)
+	{
+		QVector<float> row(n);
+		for (int i = begin; i < end && !(cancellation && cancellation->load()); ++i)
+		{
+			for (int j = 0; j < n; ++j)
+			{
+				double squareSum = 0;
+				for (int c = 0; c < channelCount; ++c)
+				{
+					double difference = channels[c][i] - channels[c][j];
+					squareSum += difference * difference;
+				}
+
+				row[j] = qExp(-squareSum / weightRatioSquare);
+			}
+
+			if (halfData)
+			{
+				qFloatToFloat16(halfData + qint64(i) * n, row.constData(), n);
+			}
+			else
+			{
+				std::copy(row.constBegin(), row.constEnd(), singleData + qint64(i) * n);
+			}
+		}
+	};
+
+	ParallelFor::run(n, buildRows);
+	if (cancellation && cancellation->load())
+	{
+		clear();
+	}
+}
+
+void AffinityMatrix::clear()
+{
+	n = 0;
+	singles.clear();
+	singles.squeeze();
+	halves.clear();
+	halves.squeeze();
+}
+
+void AffinityMatrix::compact(const QVector<bool>& keep)
+{
+	QVector<int> keptIndices;
+	for (int i = 0; i < n; ++i)
+	{
+		if (keep[i])
+		{
+			keptIndices.append(i);
+		}
+	}
+
+	int keptCount = keptIndices.size();
+	if (storagePrecision == HALF_PRECISION)
+	{
+		compactRows(halves.data(), n, keptIndices);
+		halves.resize(keptCount * keptCount);
+	}
+	else
+	{
+		compactRows(singles.data(), n, keptIndices);
+		singles.resize(keptCount * keptCount);
+	}
+
+	n = keptCount;
+}
+
+void AffinityMatrix::row(int i, double* y) const
+{
+	if (storagePrecision == HALF_PRECISION)
+	{
+		const qfloat16* row = halves.constData() + qint64(i) * n;
+		for (int j = 0; j < n; ++j)
+		{
+			y[j] = row[j];
+		}
+	}
+	else
+	{
+		const float* row = singles.constData() + qint64(i) * n;
+		std::copy(row, row + n, y);
+	}
+}
+
+void AffinityMatrix::multiply(int beginRow, int endRow, const double* x, double* y) const
+{
+	float block[COLUMN_BLOCK_SIZE];
+
+	for (int blockRow = beginRow; blockRow < endRow; blockRow += ROW_BLOCK_SIZE)
+	{
+		int blockEndRow = qMin(blockRow + ROW_BLOCK_SIZE, endRow);
+		double sums[ROW_BLOCK_SIZE] = {};
+
+		for (int blockColumn = 0; blockColumn < n; blockColumn += COLUMN_BLOCK_SIZE)
+		{
+			int blockWidth = qMin(COLUMN_BLOCK_SIZE, n - blockColumn);
+			const double* xBlock = x + blockColumn;
+
+			for (int i = blockRow; i < blockEndRow; ++i)
+			{
+				const float* row;
+				if (storagePrecision == HALF_PRECISION)
+				{
+					qFloatFromFloat16(block, halves.constData() + qint64(i) * n + blockColumn, blockWidth);
+					row = block;
+				}
+				else
+				{
+					row = singles.constData() + qint64(i) * n + blockColumn;
+				}
+
+				double sum = 0;
+				for (int j = 0; j < blockWidth; ++j)
+				{
+					sum += row[j] * xBlock[j];
+				}
+
+				sums[i - blockRow] += sum;
+			}
+		}
+
+		for (int i = blockRow; i < blockEndRow; ++i)
+		{
+			y[i] = sums[i - blockRow];
+		}
+	}
+}
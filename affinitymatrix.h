@@ -0,0 +1,51 @@
+#ifndef AFFINITYMATRIX_H
+#define AFFINITYMATRIX_H
+
+#include <climits>
+#include <QAtomicInteger>
+#include <QFloat16>
+#include <QVector>
+
+class AffinityMatrix
+{
+public:
+	enum Precision
+	{
+		SINGLE_PRECISION, HALF_PRECISION
+	};
+
+	static const int ROW_BLOCK_SIZE = 4;
+	static const int COLUMN_BLOCK_SIZE = 2048;
+	static const qint64 MAXIMAL_BYTES = qint64(INT_MAX) - 64; // Qt 5 containers hold at most 2 GiB
+
+	static qint64 requiredBytes(int size, Precision precision);
+	static bool fits(int size, Precision precision, qint64 budgetBytes);
+
+	bool isNull() const { return n == 0; }
+	int size() const { return n; }
+	Precision precision() const { return storagePrecision; }
+	qint64 bytes() const { return requiredBytes(n, storagePrecision); }
+
+	// affinities are exp(-|features(i) - features(j)|^2 / weightRatioSquare); the build stops
+	// within a row once *cancellation is set, leaving the matrix null
+	void build(const float* const* channels, int channelCount, int size,
+		double weightRatioSquare, Precision precision, const QAtomicInt* cancellation = nullptr);
+	void clear();
+
+	// keeps the rows and columns i where keep[i] is set, preserving their order
+	void compact(const QVector<bool>& keep);
+
+	// y[i] = sum of A(i, j) * x[j] for beginRow <= i < endRow
+	void multiply(int beginRow, int endRow, const double* x, double* y) const;
+
+	// y[j] = A(i, j) for every j
+	void row(int i, double* y) const;
+
+private:
+	int n = 0;
+	Precision storagePrecision = SINGLE_PRECISION;
+	QVector<float> singles;
+	QVector<qfloat16> halves;
+};
+
+#endif // AFFINITYMATRIX_H
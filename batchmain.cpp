@@ -0,0 +1,243 @@
+#include "doserbatch.h"
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QtMath>
+#include <QTextStream>
+
+namespace
+{
+	bool parseMode(const QString& name, DoserModel::SegmentationMode& mode)
+	{
+		if (name == "quick")
+		{
+			mode = DoserModel::QUICK_MODE;
+		}
+		else if (name == "deep")
+		{
+			mode = DoserModel::DEEP_MODE;
+		}
+		else if (name == "sparse")
+		{
+			mode = DoserModel::SPARSE_MODE;
+		}
+		else if (name == "pyramid")
+		{
+			mode = DoserModel::PYRAMID_MODE;
+		}
+		else if (name == "tiled")
+		{
+			mode = DoserModel::TILED_MODE;
+		}
+		else if (name == "budgeted")
+		{
+			mode = DoserModel::BUDGETED_MODE;
+		}
+		else
+		{
+			return false;
+		}
+
+		return true;
+	}
+
+	bool parseDynamics(const QString& name, ReplicatorEngine::Dynamics& dynamics)
+	{
+		if (name == "replicator")
+		{
+			dynamics = ReplicatorEngine::REPLICATOR_DYNAMICS;
+		}
+		else if (name == "exponential")
+		{
+			dynamics = ReplicatorEngine::EXPONENTIAL_DYNAMICS;
+		}
+		else if (name == "infection-immunization")
+		{
+			dynamics = ReplicatorEngine::INFECTION_IMMUNIZATION_DYNAMICS;
+		}
+		else
+		{
+			return false;
+		}
+
+		return true;
+	}
+
+	bool parseSamplingStrategy(const QString& name, Sampler::Strategy& strategy)
+	{
+		if (name == "uniform")
+		{
+			strategy = Sampler::UNIFORM_SAMPLING;
+		}
+		else if (name == "grid")
+		{
+			strategy = Sampler::GRID_SAMPLING;
+		}
+		else if (name == "blue-noise")
+		{
+			strategy = Sampler::BLUE_NOISE_SAMPLING;
+		}
+		else if (name == "colors")
+		{
+			strategy = Sampler::COLOR_SAMPLING;
+		}
+		else
+		{
+			return false;
+		}
+
+		return true;
+	}
+
+	// a single value, or a comma-separated list of values to sweep
+	bool parseValues(const QString& text, QVector<double>& values)
+	{
+		values.clear();
+		for (const QString& item : text.split(','))
+		{
+			bool isNumber = false;
+			values.append(item.toDouble(&isNumber));
+			if (!isNumber)
+			{
+				return false;
+			}
+		}
+
+		return true;
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	QCoreApplication a(argc, argv);
+	QCoreApplication::setApplicationName("doser-batch");
+
+	QCommandLineParser parser;
+	parser.setApplicationDescription("Segments images with dominant sets, without a GUI.");
+	parser.addHelpOption();
+	parser.addPositionalArgument("inputs", "Image files, or directories of images.", "inputs...");
+
+	// defaults follow the settings of the GUI
+
+	QCommandLineOption outputOption({"o", "output"}, "Output directory.", "directory", ".");
+	QCommandLineOption formatOption("format", "Output format: colors or labels.", "format", "colors");
+	QCommandLineOption modeOption("mode", "Segmentation mode: quick, deep, sparse, pyramid, tiled or budgeted.", "mode", "quick");
+	QCommandLineOption targetRatioOption("target-ratio", "Target segmentation ratio in percent.", "ratio", "90");
+	QCommandLineOption minimalSizeOption("minimal-size", "Minimal segment size in pixels, or a list to sweep.", "size", "50");
+	QCommandLineOption precisionOption("precision",
+		"Iteration precision, the change of the weights below which a pass ends a peel, or a list to sweep.",
+		"precision", "0.01");
+	QCommandLineOption dynamicsOption("dynamics",
+		"Dynamics: replicator, exponential or infection-immunization.", "dynamics", "replicator");
+	QCommandLineOption samplingRatioOption("sampling-ratio", "Sampling ratio in percent.", "ratio", "10");
+	QCommandLineOption samplingOption("sampling",
+		"Sampling strategy: uniform, grid, blue-noise or colors.", "strategy", "uniform");
+	QCommandLineOption seedOption("seed", "Sampling seed, 0 for a random one.", "seed", "0");
+	QCommandLineOption weightRatioOption("weight-ratio", "Weight ratio, or a list to sweep.", "ratio", "2");
+	QCommandLineOption spatialRadiusOption("spatial-radius", "Spatial radius in pixels, sparse mode only.", "radius", "5");
+	QCommandLineOption neighborsOption("neighbors",
+		"Most similar neighbors kept per node, 0 for all within the radius; sparse mode only.", "count", "0");
+	QCommandLineOption pyramidLevelsOption("pyramid-levels",
+		"Number of halvings of the resolution, pyramid mode only.", "count", "3");
+	QCommandLineOption superpixelsOption("superpixels",
+		"Number of superpixels segmented instead of pixels, 0 for none; not in sparse mode.", "count", "0");
+	QCommandLineOption tileSizeOption("tile-size", "Tile size in pixels, tiled mode only.", "size", "512");
+	QCommandLineOption tileOverlapOption("tile-overlap", "Overlap of neighbouring tiles in pixels.", "overlap", "16");
+	QCommandLineOption timeBudgetOption("time-budget",
+		"Time budget in milliseconds, budgeted mode only; sets the sampling ratio.", "ms", "1000");
+	QCommandLineOption landmarksOption("landmarks",
+		"Landmarks per segment in extrapolation and merging, 0 for every member.", "count", "0");
+	QCommandLineOption verifyLandmarksOption("verify-landmarks",
+		"Also decide exactly and count the differing decisions in the stats.");
+	QCommandLineOption affinityCacheOption("affinity-cache",
+		"Memory for the affinities among the sampled nodes in MiB, 0 for none, at most 2047; not in sparse mode.",
+		"MiB", "256");
+	QCommandLineOption halfPrecisionOption("half-precision", "Store cached affinities in half precision.");
+	QCommandLineOption grayscaleOption("grayscale", "Force grayscale.");
+	QCommandLineOption collapseOption("collapse", "Collapse identical colors.");
+	QCommandLineOption statsOption("stats", "Also write the segmentation stats of each image as JSON.");
+	QCommandLineOption jobsOption({"j", "jobs"}, "Number of images segmented concurrently.", "count", "1");
+	QCommandLineOption threadsOption("threads", "Total number of threads.", "count",
+		QString::number(QThread::idealThreadCount()));
+
+	parser.addOptions({outputOption, formatOption, modeOption, targetRatioOption, minimalSizeOption,
+		precisionOption, dynamicsOption, samplingRatioOption, samplingOption, seedOption, weightRatioOption,
+		spatialRadiusOption, neighborsOption, pyramidLevelsOption, superpixelsOption, tileSizeOption,
+		tileOverlapOption, timeBudgetOption, landmarksOption, verifyLandmarksOption, affinityCacheOption,
+		halfPrecisionOption, grayscaleOption, collapseOption, statsOption, jobsOption, threadsOption});
+	parser.process(a);
+
+	DoserBatch::Options options;
+	options.outputDirectory = parser.value(outputOption);
+	options.format = parser.value(formatOption) == "labels" ? DoserBatch::LABEL_OUTPUT : DoserBatch::COLOR_OUTPUT;
+	options.saveStats = parser.isSet(statsOption);
+	options.jobCount = parser.value(jobsOption).toInt();
+	options.threadCount = parser.value(threadsOption).toInt();
+
+	DoserModel::SegmentationParameters& parameters = options.parameters;
+	parameters.targetSegmentationRatio = parser.value(targetRatioOption).toDouble() / 100.0;
+	parameters.samplingProbability = parser.value(samplingRatioOption).toDouble() / 100.0;
+	parameters.samplingSeed = parser.value(seedOption).toUInt();
+	parameters.spatialRadius = parser.value(spatialRadiusOption).toInt();
+	parameters.spatialWeightRatioSquare = qPow(parameters.spatialRadius, 2);
+	parameters.maximalNeighborCount = parser.value(neighborsOption).toInt();
+	parameters.pyramidLevelCount = parser.value(pyramidLevelsOption).toInt();
+	parameters.superpixelCount = parser.value(superpixelsOption).toInt();
+	parameters.tileSize = parser.value(tileSizeOption).toInt();
+	parameters.tileOverlap = parser.value(tileOverlapOption).toInt();
+	parameters.timeBudget = parser.value(timeBudgetOption).toDouble();
+	parameters.landmarkCount = parser.value(landmarksOption).toInt();
+	parameters.verifyLandmarks = parser.isSet(verifyLandmarksOption);
+	parameters.affinityCacheBudget = qBound(0.0, parser.value(affinityCacheOption).toDouble(),
+		AffinityMatrix::MAXIMAL_BYTES / (1024.0 * 1024.0));
+	parameters.halfPrecisionAffinities = parser.isSet(halfPrecisionOption);
+	parameters.forceGrayscale = parser.isSet(grayscaleOption);
+	parameters.collapseIdenticalFeatures = parser.isSet(collapseOption);
+
+	QTextStream err(stderr);
+	if (!parseMode(parser.value(modeOption), options.mode)
+		|| !parseDynamics(parser.value(dynamicsOption), parameters.dynamics)
+		|| !parseSamplingStrategy(parser.value(samplingOption), parameters.samplingStrategy))
+	{
+		err << "Unknown mode, dynamics or sampling strategy.\n";
+		return 2;
+	}
+
+	// several values of any of the swept options make a grid of every combination
+
+	QVector<double> minimalSizes, precisions, weightRatios;
+	if (!parseValues(parser.value(minimalSizeOption), minimalSizes)
+		|| !parseValues(parser.value(precisionOption), precisions)
+		|| !parseValues(parser.value(weightRatioOption), weightRatios))
+	{
+		err << "Invalid minimal size, precision or weight ratio.\n";
+		return 2;
+	}
+
+	for (double minimalSize : minimalSizes)
+	{
+		for (double precision : precisions)
+		{
+			for (double weightRatio : weightRatios)
+			{
+				DoserModel::SegmentationParameters runParameters = parameters;
+				runParameters.minimalSegmentSize = int(minimalSize);
+				runParameters.iterationPrecision = precision;
+				runParameters.weightRatioSquare = qPow(weightRatio, 2);
+				options.grid.append(runParameters);
+			}
+		}
+	}
+
+	if (options.grid.size() == 1)
+	{
+		parameters = options.grid.takeFirst();
+	}
+
+	if (parser.positionalArguments().isEmpty())
+	{
+		parser.showHelp(2);
+	}
+
+	DoserBatch batch(options);
+	return batch.run(parser.positionalArguments()) == 0 ? 0 : 1;
+}
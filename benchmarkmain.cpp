@@ -0,0 +1,73 @@
+#include "doserbenchmark.h"
+#include <QCommandLineParser>
+#include <QFile>
+#include <QCoreApplication>
+#include <QTextStream>
+
+namespace
+{
+#if QT_VERSION >= QT_VERSION_CHECK(5, 14, 0)
+	const Qt::SplitBehavior SKIP_EMPTY_PARTS = Qt::SkipEmptyParts;
+#else
+	const QString::SplitBehavior SKIP_EMPTY_PARTS = QString::SkipEmptyParts;
+#endif
+
+	QVector<double> parseList(const QString& text)
+	{
+		QVector<double> values;
+		for (const QString& item : text.split(',', SKIP_EMPTY_PARTS))
+		{
+			values.append(item.toDouble());
+		}
+
+		return values;
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	QCoreApplication a(argc, argv);
+	QCoreApplication::setApplicationName("doser-benchmark");
+
+	QCommandLineParser parser;
+	parser.setApplicationDescription("Times the phases of the segmentation pipeline and prints the results as JSON.");
+	parser.addHelpOption();
+	parser.addPositionalArgument("images", "Real images to benchmark besides the synthetic ones.", "[images...]");
+
+	QCommandLineOption outputOption({"o", "output"}, "Output file, standard output by default.", "file");
+	QCommandLineOption resolutionsOption("resolutions", "Comma-separated image sizes.", "sizes", "128,256,512");
+	QCommandLineOption samplingOption("sampling", "Comma-separated sampling probabilities.", "probabilities", "0.05,0.1");
+	QCommandLineOption repetitionsOption("repetitions", "Repetitions of each measurement.", "count", "5");
+	QCommandLineOption microOption("micro", "Only time the individual phases, not full segmentations.");
+
+	parser.addOptions({outputOption, resolutionsOption, samplingOption, repetitionsOption, microOption});
+	parser.process(a);
+
+	DoserBenchmark::Options options;
+	options.imagePaths = parser.positionalArguments();
+	options.resolutions.clear();
+	for (double resolution : parseList(parser.value(resolutionsOption)))
+	{
+		options.resolutions.append(resolution);
+	}
+
+	options.samplingProbabilities = parseList(parser.value(samplingOption));
+	options.repetitionCount = qMax(1, parser.value(repetitionsOption).toInt());
+	options.includeFullRuns = !parser.isSet(microOption);
+
+	QByteArray json = DoserBenchmark(options).run().toJson();
+	if (!parser.isSet(outputOption))
+	{
+		QTextStream(stdout) << json;
+		return 0;
+	}
+
+	QFile file(parser.value(outputOption));
+	if (!file.open(QIODevice::WriteOnly) || file.write(json) != json.size())
+	{
+		QTextStream(stderr) << "Failed to write " << parser.value(outputOption) << '\n';
+		return 1;
+	}
+
+	return 0;
+}
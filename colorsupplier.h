@@ -2,7 +2,7 @@
 #define COLORSUPPLIER_H
 
 #include <QColor>
-#include <QTime>
+#include <QRandomGenerator>
 #include <QVector>
 
 class ColorSupplier
@@ -23,7 +23,7 @@ public:
 	{
 		if (currentColors.isEmpty())
 		{
-			return QColor(qrand() % 255, qrand() % 255, qrand() % 255);
+			return QColor(generator.bounded(255), generator.bounded(255), generator.bounded(255));
 		}
 		else
 		{
@@ -34,12 +34,13 @@ public:
 	void reset()
 	{
 		currentColors = defaultColors;
-		qsrand(24);
+		generator.seed(24);
 	}
 
 private:
 	QVector<QColor> defaultColors;
 	QVector<QColor> currentColors;
+	QRandomGenerator generator;
 };
 
 #endif // COLORSUPPLIER_H
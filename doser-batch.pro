@@ -0,0 +1,18 @@
+# headless batch segmentation, without widgets or a GUI platform plugin
+
+include(doser.pri)
+
+TARGET = doser-batch
+TEMPLATE = app
+CONFIG += console
+CONFIG -= app_bundle
+
+# all targets build the core from the same directory
+OBJECTS_DIR = .obj/batch
+MOC_DIR = .moc/batch
+
+SOURCES += batchmain.cpp \
+	doserbatch.cpp
+
+HEADERS += doserbatch.h \
+	colorsupplier.h
@@ -0,0 +1,17 @@
+# timings of the segmentation phases, printed as JSON
+
+include(doser.pri)
+
+TARGET = doser-benchmark
+TEMPLATE = app
+CONFIG += console
+CONFIG -= app_bundle
+
+# all targets build the core from the same directory
+OBJECTS_DIR = .obj/benchmark
+MOC_DIR = .moc/benchmark
+
+SOURCES += benchmarkmain.cpp \
+	doserbenchmark.cpp
+
+HEADERS += doserbenchmark.h
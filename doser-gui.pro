@@ -0,0 +1,26 @@
+#-------------------------------------------------
+#
+# Project created by QtCreator 2017-03-21T11:49:14
+#
+#-------------------------------------------------
+
+include(doser.pri)
+
+greaterThan(QT_MAJOR_VERSION, 4): QT += widgets
+
+TARGET = doser
+TEMPLATE = app
+
+# all targets build the core from the same directory
+OBJECTS_DIR = .obj/gui
+MOC_DIR = .moc/gui
+
+SOURCES += main.cpp\
+	dosermainwindow.cpp \
+	doserwidget.cpp \
+	segmentview.cpp
+
+HEADERS += dosermainwindow.h \
+	doserwidget.h \
+	segmentview.h \
+	colorsupplier.h
@@ -0,0 +1,33 @@
+# segmentation core, shared by the GUI and the batch tool
+
+QT += core gui concurrent
+
+SOURCES += \
+	$$PWD/dosermodel.cpp \
+	$$PWD/affinitymatrix.cpp \
+	$$PWD/featurebuffer.cpp \
+	$$PWD/fitnesskernel.cpp \
+	$$PWD/labelmap.cpp \
+	$$PWD/parallelfor.cpp \
+	$$PWD/progressthrottle.cpp \
+	$$PWD/replicatorengine.cpp \
+	$$PWD/sampler.cpp \
+	$$PWD/sparseaffinitygraph.cpp \
+	$$PWD/superpixels.cpp \
+	$$PWD/weightedsegment.cpp
+
+HEADERS += \
+	$$PWD/dosermodel.h \
+	$$PWD/affinitymatrix.h \
+	$$PWD/featurebuffer.h \
+	$$PWD/fitnesskernel.h \
+	$$PWD/labelmap.h \
+	$$PWD/parallelfor.h \
+	$$PWD/progressthrottle.h \
+	$$PWD/replicatorengine.h \
+	$$PWD/sampler.h \
+	$$PWD/sparseaffinitygraph.h \
+	$$PWD/superpixels.h \
+	$$PWD/weightedsegment.h
+
+INCLUDEPATH += $$PWD
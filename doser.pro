@@ -1,22 +1,7 @@
-#-------------------------------------------------
-#
-# Project created by QtCreator 2017-03-21T11:49:14
-#
-#-------------------------------------------------
+TEMPLATE = subdirs
 
-QT += core gui concurrent
+SUBDIRS = gui batch benchmark
 
-greaterThan(QT_MAJOR_VERSION, 4): QT += widgets
-
-TARGET = doser
-TEMPLATE = app
-
-SOURCES += main.cpp\
-	dosermainwindow.cpp \
-	doserwidget.cpp \
-	dosermodel.cpp
-
-HEADERS += dosermainwindow.h \
-	doserwidget.h \
-	dosermodel.h \
-	colorsupplier.h
+gui.file = doser-gui.pro
+batch.file = doser-batch.pro
+benchmark.file = doser-benchmark.pro
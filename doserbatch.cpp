@@ -0,0 +1,233 @@
+#include "doserbatch.h"
+
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QFuture>
+#include <QHash>
+#include <QImageReader>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QTextStream>
+#include <QThreadPool>
+#include <QtConcurrent/QtConcurrent>
+
+#include "colorsupplier.h"
+
+// constructor
+
+DoserBatch::DoserBatch(const Options& options) : options(options)
+{
+}
+
+// public functions
+
+int DoserBatch::run(const QStringList& inputs) const
+{
+	QDir().mkpath(options.outputDirectory);
+
+	// outputs are named after the input file, so equal names in different directories would overwrite
+	// each other; all but the first of them fail
+
+	QStringList paths;
+	QHash<QString, QString> stemOwners;
+	int failureCount = 0;
+	for (const QString& path : collectImagePaths(inputs))
+	{
+		QString stem = outputStem(path).toLower();
+		if (stemOwners.contains(stem))
+		{
+			QTextStream(stderr) << path << ": same output name as " << stemOwners.value(stem) << '\n';
+			++failureCount;
+			continue;
+		}
+
+		stemOwners.insert(stem, path);
+		paths.append(path);
+	}
+
+	// every job thread takes part in its own parallel loops, so the shared pool gets the rest
+
+	int jobCount = qBound(1, options.jobCount, qMax(1, paths.size()));
+	QThreadPool::globalInstance()->setMaxThreadCount(qMax(1, options.threadCount - jobCount));
+
+	QThreadPool jobPool;
+	jobPool.setMaxThreadCount(jobCount);
+
+	QVector<QFuture<bool>> jobs;
+	for (const QString& path : paths)
+	{
+		jobs.append(QtConcurrent::run(&jobPool, [this, path]() { return process(path); }));
+	}
+
+	QTextStream out(stdout);
+	for (int i = 0; i < jobs.size(); ++i)
+	{
+		if (jobs[i].result())
+		{
+			out << paths[i] << " -> " << (options.grid.isEmpty() ? outputPath(paths[i]) : sweepPath(paths[i])) << '\n';
+		}
+		else
+		{
+			out << paths[i] << " failed\n";
+			++failureCount;
+		}
+
+		out.flush(); // reported as each image completes
+	}
+
+	return failureCount;
+}
+
+// utility functions
+
+QStringList DoserBatch::collectImagePaths(const QStringList& inputs) const
+{
+	QStringList nameFilters;
+	for (const QByteArray& format : QImageReader::supportedImageFormats())
+	{
+		nameFilters.append("*." + QString(format));
+	}
+
+	QStringList paths;
+	for (const QString& input : inputs)
+	{
+		if (!QFileInfo(input).isDir())
+		{
+			paths.append(input);
+			continue;
+		}
+
+		QDir directory(input);
+		for (const QString& fileName : directory.entryList(nameFilters, QDir::Files | QDir::Readable, QDir::Name))
+		{
+			paths.append(directory.filePath(fileName));
+		}
+	}
+
+	return paths;
+}
+
+bool DoserBatch::process(const QString& path) const
+{
+	// the model lives on this job thread, so its signals arrive synchronously
+
+	DoserModel model;
+	QImage image;
+	LabelMap labelMap;
+	DoserModel::SegmentationStats stats;
+
+	QObject::connect(&model, &DoserModel::imageChanged,
+		[&](const QImage& newImage, const QSize&) { image = newImage; });
+	QObject::connect(&model, &DoserModel::imageRejected,
+		[&](const QString& reason) { QTextStream(stderr) << path << ": " << reason << '\n'; });
+	QObject::connect(&model, &DoserModel::segmentationFinished,
+		[&](DoserModel::SegmentationMode, const LabelMap& finalLabelMap,
+			const DoserModel::SegmentationStats& finalStats)
+		{
+			labelMap = finalLabelMap;
+			stats = finalStats;
+		});
+
+	model.openImage(path);
+	if (image.isNull())
+	{
+		return false;
+	}
+	else if (!options.grid.isEmpty())
+	{
+		return processSweep(model, path);
+	}
+
+	model.segment(options.mode, options.parameters);
+	if (options.saveStats && !stats.save(statsPath(path)))
+	{
+		return false;
+	}
+
+	return render(labelMap).save(outputPath(path));
+}
+
+bool DoserBatch::processSweep(DoserModel& model, const QString& path) const
+{
+	// one image per run, and a table of the parameters and stats of every run
+
+	QVector<DoserModel::SweepResult> results;
+	QObject::connect(&model, &DoserModel::sweepFinished,
+		[&](DoserModel::SegmentationMode, const QVector<DoserModel::SweepResult>& finalResults)
+		{
+			results = finalResults;
+		});
+
+	model.sweep(options.mode, options.grid);
+
+	QJsonArray table;
+	for (int r = 0; r < results.size(); ++r)
+	{
+		if (!render(results[r].labelMap).save(outputPath(path, r)))
+		{
+			return false;
+		}
+
+		table.append(results[r].toJson());
+	}
+
+	QFile file(sweepPath(path));
+	QByteArray json = QJsonDocument(table).toJson();
+	return !results.isEmpty() && file.open(QIODevice::WriteOnly) && file.write(json) == json.size();
+}
+
+QImage DoserBatch::render(const LabelMap& labelMap) const
+{
+	// label maps store the index of the segment plus one in the RGB channels, 0 being unlabeled
+
+	QVector<QRgb> palette(labelMap.segmentCount() + 1);
+	palette[0] = qRgb(0, 0, 0);
+
+	ColorSupplier colorSupplier;
+	for (int label = 1; label < palette.size(); ++label)
+	{
+		palette[label] = options.format == LABEL_OUTPUT ? QRgb(label) : colorSupplier.nextColor().rgb();
+	}
+
+	QImage output(labelMap.width(), labelMap.height(), QImage::Format_RGB32);
+	for (int y = 0; y < labelMap.height(); ++y)
+	{
+		const LabelMap::Label* labels = labelMap.constScanLine(y);
+		QRgb* line = reinterpret_cast<QRgb*>(output.scanLine(y));
+
+		for (int x = 0; x < labelMap.width(); ++x)
+		{
+			line[x] = palette[labels[x]];
+		}
+	}
+
+	return output;
+}
+
+QString DoserBatch::outputPath(const QString& path, int run) const
+{
+	QString suffix = options.format == LABEL_OUTPUT ? "-labels.png" : "-segments.png";
+	if (run >= 0)
+	{
+		suffix = "-" + QString::number(run) + suffix;
+	}
+
+	return outputStem(path) + suffix;
+}
+
+QString DoserBatch::outputStem(const QString& path) const
+{
+	// the suffix is kept, so that img.png and img.jpg do not collide
+	return QDir(options.outputDirectory).filePath(QFileInfo(path).fileName());
+}
+
+QString DoserBatch::sweepPath(const QString& path) const
+{
+	return outputStem(path) + "-sweep.json";
+}
+
+QString DoserBatch::statsPath(const QString& path) const
+{
+	return outputStem(path) + "-stats.json";
+}
@@ -0,0 +1,50 @@
+#ifndef DOSERBATCH_H
+#define DOSERBATCH_H
+
+#include <QImage>
+#include <QString>
+#include <QStringList>
+#include <QThread>
+#include <QVector>
+
+#include "dosermodel.h"
+
+class DoserBatch
+{
+public:
+	enum OutputFormat
+	{
+		LABEL_OUTPUT, COLOR_OUTPUT
+	};
+
+	struct Options
+	{
+		DoserModel::SegmentationMode mode = DoserModel::QUICK_MODE;
+		DoserModel::SegmentationParameters parameters;
+		QVector<DoserModel::SegmentationParameters> grid; // swept instead of parameters, if not empty
+		OutputFormat format = COLOR_OUTPUT;
+		bool saveStats = false;
+		QString outputDirectory = ".";
+		int jobCount = 1; // images segmented concurrently
+		int threadCount = QThread::idealThreadCount(); // in total, the job threads included
+	};
+
+	explicit DoserBatch(const Options& options);
+
+	// returns the number of images that could not be segmented or saved
+	int run(const QStringList& inputs) const;
+
+private:
+	QStringList collectImagePaths(const QStringList& inputs) const;
+	bool process(const QString& path) const;
+	bool processSweep(DoserModel& model, const QString& path) const;
+	QImage render(const LabelMap& labelMap) const;
+	QString outputStem(const QString& path) const; // the outputs of an image share it
+	QString outputPath(const QString& path, int run = -1) const;
+	QString sweepPath(const QString& path) const;
+	QString statsPath(const QString& path) const;
+
+	Options options;
+};
+
+#endif // DOSERBATCH_H
@@ -0,0 +1,367 @@
+#include "doserbenchmark.h"
+
+#include <algorithm>
+#include <QElapsedTimer>
+#include <QFileInfo>
+#include <QRandomGenerator>
+#include <QThreadPool>
+
+#include "fitnesskernel.h"
+
+const int DoserBenchmark::WEIGHT_CALL_COUNT;
+const int DoserBenchmark::MERGE_SEGMENT_COUNT;
+const int DoserBenchmark::SWEEP_CACHE_BUDGET;
+const quint32 DoserBenchmark::SEED;
+
+// constructor
+
+DoserBenchmark::DoserBenchmark(const Options& options) : options(options)
+{
+	parameters.weightRatioSquare = 4; // the default of the GUI
+	parameters.samplingSeed = SEED;
+}
+
+// public functions
+
+QJsonDocument DoserBenchmark::run() const
+{
+	QVector<QPair<QString, QImage>> sources;
+	for (int resolution : options.resolutions)
+	{
+		sources.append(qMakePair(QString("synthetic"), synthesize(resolution)));
+
+		for (const QString& path : options.imagePaths)
+		{
+			QImage image(path);
+			if (!image.isNull())
+			{
+				sources.append(qMakePair(QFileInfo(path).fileName(),
+					image.scaled(resolution, resolution, Qt::KeepAspectRatio, Qt::SmoothTransformation)));
+			}
+		}
+	}
+
+	QJsonArray results;
+	for (const QPair<QString, QImage>& source : sources)
+	{
+		QVector<QImage> variants = { source.second.convertToFormat(QImage::Format_RGB32),
+			source.second.convertToFormat(QImage::Format_Grayscale8) };
+
+		for (const QImage& variant : variants)
+		{
+			for (double samplingProbability : options.samplingProbabilities)
+			{
+				for (const QJsonValue& result : measure(variant, samplingProbability))
+				{
+					QJsonObject object = result.toObject();
+					object["image"] = source.first;
+					results.append(object);
+				}
+			}
+		}
+	}
+
+	QJsonObject root;
+	root["instructionSet"] = FitnessKernel::toString(FitnessKernel::instructionSet());
+	root["threadCount"] = QThreadPool::globalInstance()->maxThreadCount();
+	root["results"] = results;
+	return QJsonDocument(root);
+}
+
+// benchmarks
+
+QJsonArray DoserBenchmark::measure(const QImage& image, double samplingProbability) const
+{
+	DoserModel model;
+	load(model, image);
+	model.parameters = parameters;
+	model.parameters.samplingProbability = samplingProbability;
+
+	QJsonArray phases;
+	phases.append(measureWeight(model));
+	phases.append(measureIterate(model));
+	phases.append(measureExtrapolate(model));
+	phases.append(measureMerge(model));
+
+	if (options.includeFullRuns)
+	{
+		phases.append(measureSegment(model, DoserModel::QUICK_MODE));
+		phases.append(measureSegment(model, DoserModel::SPARSE_MODE));
+		phases.append(measureSweep(model));
+	}
+
+	QJsonArray results;
+	for (const QJsonValue& phase : phases)
+	{
+		QJsonObject result = phase.toObject();
+		result["width"] = image.width();
+		result["height"] = image.height();
+		result["grayscale"] = model.features.isGrayscale();
+		result["samplingProbability"] = samplingProbability;
+		results.append(result);
+	}
+
+	return results;
+}
+
+QJsonObject DoserBenchmark::measureWeight(DoserModel& model) const
+{
+	QRandomGenerator generator(SEED);
+	int pixelCount = model.features.size();
+	QVector<QPair<DoserModel::Pixel, DoserModel::Pixel>> pairs(4096);
+	for (int i = 0; i < pairs.size(); ++i)
+	{
+		pairs[i].first = model.features.pixelAt(generator.bounded(pixelCount));
+		pairs[i].second = model.features.pixelAt(generator.bounded(pixelCount));
+	}
+
+	model.useGrayscale = model.features.isGrayscale();
+
+	QVector<qint64> nanoseconds;
+	volatile double sink = 0;
+	for (int r = 0; r < options.repetitionCount; ++r)
+	{
+		QElapsedTimer timer;
+		timer.start();
+
+		double sum = 0;
+		for (int i = 0; i < WEIGHT_CALL_COUNT; ++i)
+		{
+			const auto& pair = pairs.at(i % pairs.size());
+			sum += model.weight(pair.first, pair.second);
+		}
+
+		nanoseconds.append(timer.nsecsElapsed());
+		sink = sink + sum;
+	}
+
+	return summarize("weight", nanoseconds, WEIGHT_CALL_COUNT);
+}
+
+QJsonObject DoserBenchmark::measureIterate(DoserModel& model) const
+{
+	QVector<qint64> nanoseconds;
+	int nodeCount = 0;
+	for (int r = 0; r < options.repetitionCount; ++r)
+	{
+		prepare(model);
+		nodeCount = model.internalNodes.size();
+
+		QElapsedTimer timer;
+		timer.start();
+		model.iterate();
+		nanoseconds.append(timer.nsecsElapsed());
+
+		model.isSegmenting = false;
+	}
+
+	return summarize("iterate", nanoseconds, nodeCount);
+}
+
+QJsonObject DoserBenchmark::measureExtrapolate(DoserModel& model) const
+{
+	QVector<qint64> nanoseconds;
+	int externalCount = 0;
+	for (int r = 0; r < options.repetitionCount; ++r)
+	{
+		prepare(model);
+		externalCount = model.externalPixels.size();
+
+		// a uniformly weighted segment of the first percent of the sample
+
+		int memberCount = qMax(1, model.internalNodes.size() / 100);
+		WeightedSegment weightedSegment;
+		for (int i = 0; i < memberCount; ++i)
+		{
+			weightedSegment.append(model.internalNodes[i].first, 1.0 / memberCount);
+		}
+
+		model.cacheReferenceTerm(weightedSegment);
+
+		QElapsedTimer timer;
+		timer.start();
+		model.extrapolate(weightedSegment);
+		nanoseconds.append(timer.nsecsElapsed());
+
+		model.isSegmenting = false;
+	}
+
+	return summarize("extrapolate", nanoseconds, externalCount);
+}
+
+QJsonObject DoserBenchmark::measureMerge(DoserModel& model) const
+{
+	QVector<qint64> nanoseconds;
+	int pendingCount = 0;
+	for (int r = 0; r < options.repetitionCount; ++r)
+	{
+		prepare(model);
+
+		// uniformly weighted segments of consecutive sample nodes, merging every external pixel
+
+		model.weightedSegments.clear();
+		int segmentSize = qMax(1, model.internalNodes.size() / MERGE_SEGMENT_COUNT);
+		for (int begin = 0; begin < model.internalNodes.size(); begin += segmentSize)
+		{
+			int end = qMin(begin + segmentSize, model.internalNodes.size());
+			WeightedSegment weightedSegment;
+			for (int i = begin; i < end; ++i)
+			{
+				weightedSegment.append(model.internalNodes[i].first, 1.0 / (end - begin));
+			}
+
+			model.cacheReferenceTerm(weightedSegment);
+			model.weightedSegments.append(weightedSegment);
+		}
+
+		model.pendingPixels = model.externalPixels;
+		pendingCount = model.pendingPixels.size();
+
+		QElapsedTimer timer;
+		timer.start();
+		model.merge();
+		nanoseconds.append(timer.nsecsElapsed());
+
+		model.isSegmenting = false;
+	}
+
+	return summarize("merge", nanoseconds, pendingCount);
+}
+
+QJsonObject DoserBenchmark::measureSegment(DoserModel& model, DoserModel::SegmentationMode mode) const
+{
+	QVector<qint64> nanoseconds;
+	for (int r = 0; r < options.repetitionCount; ++r)
+	{
+		QElapsedTimer timer;
+		timer.start();
+		model.segment(mode, model.parameters);
+		nanoseconds.append(timer.nsecsElapsed());
+	}
+
+	QJsonObject result = summarize(mode == DoserModel::SPARSE_MODE ? "segment-sparse" : "segment-quick",
+		nanoseconds, model.features.size());
+	result["pixelsPerSecond"] = result.value("itemsPerSecond");
+	return result;
+}
+
+QJsonObject DoserBenchmark::measureSweep(DoserModel& model) const
+{
+	// two weight ratios by two precisions; the runs of a weight ratio share one affinity matrix
+
+	QVector<DoserModel::SegmentationParameters> grid;
+	for (double weightRatioSquare : {1.0, 4.0})
+	{
+		for (double precision : {0.01, 0.001})
+		{
+			DoserModel::SegmentationParameters runParameters = model.parameters;
+			runParameters.weightRatioSquare = weightRatioSquare;
+			runParameters.iterationPrecision = precision;
+			runParameters.affinityCacheBudget = SWEEP_CACHE_BUDGET;
+			grid.append(runParameters);
+		}
+	}
+
+	int affinityBuildCount = 0;
+	QMetaObject::Connection connection = QObject::connect(&model, &DoserModel::sweepFinished,
+		[&](DoserModel::SegmentationMode, const QVector<DoserModel::SweepResult>& results)
+		{
+			affinityBuildCount = 0;
+			for (const DoserModel::SweepResult& result : results)
+			{
+				affinityBuildCount += result.stats.affinityBuildCount;
+			}
+		});
+
+	QVector<qint64> nanoseconds;
+	for (int r = 0; r < options.repetitionCount; ++r)
+	{
+		QElapsedTimer timer;
+		timer.start();
+		model.sweep(DoserModel::QUICK_MODE, grid);
+		nanoseconds.append(timer.nsecsElapsed());
+	}
+
+	QObject::disconnect(connection);
+
+	QJsonObject result = summarize("sweep-quick", nanoseconds, grid.size());
+	result["affinityBuildCount"] = affinityBuildCount; // 2 while the sample fits the cache budget
+	return result;
+}
+
+// utility functions
+
+void DoserBenchmark::load(DoserModel& model, const QImage& image) const
+{
+	model.features = FeatureBuffer(image);
+}
+
+void DoserBenchmark::prepare(DoserModel& model) const
+{
+	// the state of solve() right before its first iteration
+
+	model.initialize(DoserModel::QUICK_MODE);
+	model.gatherSampleFeatures();
+	model.cacheAffinities();
+
+	int nodeCount = model.internalNodes.size();
+	model.replicator.reset(nodeCount);
+	std::fill(model.replicator.weights(), model.replicator.weights() + nodeCount, 1.0 / nodeCount);
+}
+
+QImage DoserBenchmark::synthesize(int resolution) const
+{
+	// overlapping flat discs and squares with a little noise, reproducible across runs
+
+	QImage image(resolution, resolution, QImage::Format_RGB32);
+	image.fill(qRgb(40, 40, 40));
+	QRandomGenerator generator(SEED);
+
+	for (int i = 0; i < 12; ++i)
+	{
+		QRgb color = qRgb(generator.bounded(256), generator.bounded(256), generator.bounded(256));
+		int centerX = generator.bounded(resolution), centerY = generator.bounded(resolution);
+		int radius = resolution / 16 + generator.bounded(resolution / 6 + 1);
+
+		for (int y = qMax(0, centerY - radius); y < qMin(resolution, centerY + radius); ++y)
+		{
+			QRgb* line = reinterpret_cast<QRgb*>(image.scanLine(y));
+			for (int x = qMax(0, centerX - radius); x < qMin(resolution, centerX + radius); ++x)
+			{
+				int dx = x - centerX, dy = y - centerY;
+				if (i % 2 == 1 || dx * dx + dy * dy <= radius * radius)
+				{
+					line[x] = color;
+				}
+			}
+		}
+	}
+
+	for (int y = 0; y < resolution; ++y)
+	{
+		QRgb* line = reinterpret_cast<QRgb*>(image.scanLine(y));
+		for (int x = 0; x < resolution; ++x)
+		{
+			int noise = generator.bounded(9) - 4;
+			line[x] = qRgb(qBound(0, qRed(line[x]) + noise, 255), qBound(0, qGreen(line[x]) + noise, 255),
+				qBound(0, qBlue(line[x]) + noise, 255));
+		}
+	}
+
+	return image;
+}
+
+QJsonObject DoserBenchmark::summarize(const QString& phase, QVector<qint64> nanoseconds, int itemCount) const
+{
+	std::sort(nanoseconds.begin(), nanoseconds.end());
+	double medianMs = nanoseconds[nanoseconds.size() / 2] / 1e6;
+
+	QJsonObject result;
+	result["phase"] = phase;
+	result["repetitions"] = nanoseconds.size();
+	result["minimalMs"] = nanoseconds.first() / 1e6;
+	result["medianMs"] = medianMs;
+	result["itemCount"] = itemCount;
+	result["itemsPerSecond"] = medianMs > 0 ? itemCount / (medianMs / 1e3) : 0;
+	return result;
+}
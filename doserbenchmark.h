@@ -0,0 +1,54 @@
+#ifndef DOSERBENCHMARK_H
+#define DOSERBENCHMARK_H
+
+#include <QImage>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QStringList>
+#include <QVector>
+
+#include "dosermodel.h"
+
+class DoserBenchmark
+{
+public:
+	static const int WEIGHT_CALL_COUNT = 1 << 20;
+	static const int MERGE_SEGMENT_COUNT = 8;
+	static const int SWEEP_CACHE_BUDGET = 256; // MiB
+	static const quint32 SEED = 42; // of the synthetic images, the samples and the timed pixel pairs
+
+	struct Options
+	{
+		QStringList imagePaths; // besides the synthetic images
+		QVector<int> resolutions = {128, 256, 512};
+		QVector<double> samplingProbabilities = {0.05, 0.1};
+		int repetitionCount = 5;
+		bool includeFullRuns = true;
+	};
+
+	explicit DoserBenchmark(const Options& options);
+
+	QJsonDocument run() const;
+
+private:
+	// benchmarks
+	QJsonArray measure(const QImage& image, double samplingProbability) const;
+	QJsonObject measureWeight(DoserModel& model) const;
+	QJsonObject measureIterate(DoserModel& model) const;
+	QJsonObject measureExtrapolate(DoserModel& model) const;
+	QJsonObject measureMerge(DoserModel& model) const;
+	QJsonObject measureSegment(DoserModel& model, DoserModel::SegmentationMode mode) const;
+	QJsonObject measureSweep(DoserModel& model) const;
+
+	// utility functions
+	void load(DoserModel& model, const QImage& image) const;
+	void prepare(DoserModel& model) const;
+	QImage synthesize(int resolution) const;
+	QJsonObject summarize(const QString& phase, QVector<qint64> nanoseconds, int itemCount) const;
+
+	Options options;
+	DoserModel::SegmentationParameters parameters;
+};
+
+#endif // DOSERBENCHMARK_H
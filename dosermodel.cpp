@@ -2,35 +2,133 @@
 
 #include <algorithm>
 #include <cstdlib>
-#include <QFuture>
-#include <QtConcurrent/QtConcurrent>
-#include <QTime>
+#include <limits>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QJsonArray>
+#include <QDir>
+#include <QImageReader>
+#include <QJsonDocument>
+#include <QSet>
+#include <QStandardPaths>
 #include <QtMath>
+#include <QVarLengthArray>
 #include <QVector>
 
+#include "parallelfor.h"
+#include "superpixels.h"
+
+namespace
+{
+	// whether the runs of a sweep with these parameters sample and weigh the same nodes
+	bool sharesAffinities(const DoserModel::SegmentationParameters& p1, const DoserModel::SegmentationParameters& p2)
+	{
+		return p1.weightRatioSquare == p2.weightRatioSquare && p1.samplingProbability == p2.samplingProbability
+			&& p1.samplingStrategy == p2.samplingStrategy && p1.samplingSeed == p2.samplingSeed
+			&& p1.superpixelCount == p2.superpixelCount && p1.superpixelCompactness == p2.superpixelCompactness
+			&& p1.forceGrayscale == p2.forceGrayscale && p1.collapseIdenticalFeatures == p2.collapseIdenticalFeatures
+			&& p1.halfPrecisionAffinities == p2.halfPrecisionAffinities;
+	}
+}
+
+const qint64 DoserModel::FEATURE_STORE_PIXEL_COUNT;
+const qint64 DoserModel::MAXIMAL_PIXEL_COUNT;
+const int DoserModel::PREVIEW_SIZE;
+const int DoserModel::CALIBRATION_NODE_COUNT;
+const int DoserModel::BUDGET_PASS_COUNT;
+const int DoserModel::BUDGET_MINIMAL_NODE_COUNT;
+const double DoserModel::BUDGET_SOLVE_SHARE = 0.7;
+const double DoserModel::BUDGET_PRECISION_RELAXATION = 1000;
+
 // constructor
 
 DoserModel::DoserModel()
 {
 	qRegisterMetaType<SegmentationMode>("DoserModel::SegmentationMode");
 	qRegisterMetaType<SegmentationParameters>("DoserModel::SegmentationParameters");
-	qRegisterMetaType<Segment>("DoserModel::Segment");
-	qRegisterMetaType<QVector<Segment>>("QVector<DoserModel::Segment>");
+	qRegisterMetaType<LabelMap>("LabelMap");
+	qRegisterMetaType<LabelMap::Label>("LabelMap::Label");
+	qRegisterMetaType<QVector<LabelMap::Span>>("QVector<LabelMap::Span>");
 	qRegisterMetaType<SubProcessType>("DoserModel::SubProcessType");
+	qRegisterMetaType<SegmentationStats>("DoserModel::SegmentationStats");
+	qRegisterMetaType<QVector<SegmentationParameters>>("QVector<DoserModel::SegmentationParameters>");
+	qRegisterMetaType<QVector<SweepResult>>("QVector<DoserModel::SweepResult>");
+}
+
+void DoserModel::cancel()
+{
+	cancellationRequest.store(1);
+}
+
+// segmentation stats
+
+QJsonObject DoserModel::SegmentationStats::toJson() const
+{
+	QJsonArray passCountArray;
+	for (int passCount : passCounts)
+	{
+		passCountArray.append(passCount);
+	}
 
-	qsrand(QTime::currentTime().msec());
+	QJsonObject parameterObject;
+	parameterObject["samplingProbability"] = parameters.samplingProbability;
+	parameterObject["iterationPrecision"] = parameters.iterationPrecision;
+	parameterObject["landmarkCount"] = parameters.landmarkCount;
+	parameterObject["weightRatioSquare"] = parameters.weightRatioSquare;
+
+	QJsonObject object;
+	object["parameters"] = parameterObject;
+	object["samplingMs"] = samplingTime;
+	object["iterationMs"] = iterationTime;
+	object["extrapolationMs"] = extrapolationTime;
+	object["mergingMs"] = mergingTime;
+	object["refinementMs"] = refinementTime;
+	object["reconciliationMs"] = reconciliationTime;
+	object["peelCount"] = peelCount();
+	object["passCounts"] = passCountArray;
+	object["weightEvaluationCount"] = weightEvaluationCount;
+	object["affinityBuildCount"] = affinityBuildCount;
+	object["rejectedSegmentCount"] = rejectedSegmentCount;
+	object["pendingPixelCount"] = pendingPixelCount;
+	object["landmarkMismatchCount"] = landmarkMismatchCount;
+	object["landmarkDecisionCount"] = landmarkDecisionCount;
+	object["peakNodeBytes"] = peakNodeBytes;
+	return object;
+}
+
+bool DoserModel::SegmentationStats::save(const QString& path) const
+{
+	QFile file(path);
+	QByteArray json = QJsonDocument(toJson()).toJson();
+	return file.open(QIODevice::WriteOnly) && file.write(json) == json.size();
+}
+
+// sweep results
+
+QJsonObject DoserModel::SweepResult::toJson() const
+{
+	QJsonObject object;
+	object["targetSegmentationRatio"] = parameters.targetSegmentationRatio;
+	object["minimalSegmentSize"] = parameters.minimalSegmentSize;
+	object["iterationPrecision"] = parameters.iterationPrecision;
+	object["samplingProbability"] = parameters.samplingProbability;
+	object["weightRatioSquare"] = parameters.weightRatioSquare;
+	object["segmentCount"] = int(labelMap.segmentCount());
+	object["stats"] = stats.toJson();
+	return object;
 }
 
 // public slots
 
 void DoserModel::segment(SegmentationMode mode, SegmentationParameters parameters)
 {
+	// a request that arrived after the previous segmentation had finished must not stop this one
+	cancellationRequest.store(0);
 	this->parameters = parameters;
 
 	if (mode == BOTH_MODE)
 	{
-		doSegment(DEEP_MODE);
-		doSegment(QUICK_MODE);
+		segmentBoth();
 	}
 	else
 	{
@@ -38,6 +136,12 @@ void DoserModel::segment(SegmentationMode mode, SegmentationParameters parameter
 	}
 }
 
+void DoserModel::sweep(SegmentationMode mode, QVector<SegmentationParameters> grid)
+{
+	cancellationRequest.store(0);
+	doSweep(mode, grid);
+}
+
 void DoserModel::openImage(const QString& path)
 {
 	if (isSegmenting)
@@ -45,59 +149,231 @@ void DoserModel::openImage(const QString& path)
 		throw;
 	}
 
+	sampleCache = SampleCache();
+	superpixelCache = SuperpixelCache();
+
+	QImageReader reader(path);
+	QSize size = reader.size();
+	qint64 pixelCount = qint64(size.width()) * size.height();
+	if (size.isValid() && pixelCount > MAXIMAL_PIXEL_COUNT)
+	{
+		emit imageRejected(QString("The image has %1 megapixels, more than the %2 that can be segmented.")
+			.arg(pixelCount / 1e6, 0, 'f', 0).arg(MAXIMAL_PIXEL_COUNT / 1e6, 0, 'f', 0));
+		return;
+	}
+
+	// large images are decoded once into an on-disk feature store, and shown as a preview
+
+	if (size.isValid() && pixelCount >= FEATURE_STORE_PIXEL_COUNT)
+	{
+		QDir storeDirectory(QStandardPaths::writableLocation(QStandardPaths::CacheLocation));
+		storeDirectory.mkpath(".");
+
+		const FeatureBuffer& store = FeatureBuffer::fromStore(path,
+			storeDirectory.filePath(FeatureBuffer::storeNameOf(path)));
+		if (!store.isNull())
+		{
+			reader.setScaledSize(size.scaled(PREVIEW_SIZE, PREVIEW_SIZE, Qt::KeepAspectRatio));
+			QImage preview = reader.read();
+			if (preview.isNull())
+			{
+				emit imageRejected("The preview of the image could not be read.");
+			}
+			else
+			{
+				features = store;
+				emit imageChanged(preview, size);
+			}
+
+			return;
+		}
+	}
+
 	QImage newImage(path);
-	if (!newImage.isNull())
+	if (newImage.isNull() && size.isValid() && pixelCount >= FEATURE_STORE_PIXEL_COUNT)
+	{
+		emit imageRejected("The image could not be decoded. Large images are decoded once into a feature store, "
+			"but must still fit in memory at 4 bytes per pixel.");
+	}
+	else if (newImage.isNull())
+	{
+		emit imageRejected("The image could not be read.");
+	}
+	else if (qint64(newImage.width()) * newImage.height() > MAXIMAL_PIXEL_COUNT)
 	{
-		image = newImage;
-		isGrayscale = image.isGrayscale(); // expensive call
-		emit imageChanged(image);
+		emit imageRejected("The image has more pixels than can be segmented.");
 	}
+	else
+	{
+		features = FeatureBuffer(newImage);
+		emit imageChanged(newImage, newImage.size());
+	}
+}
+
+// caches of per-image work
+
+bool DoserModel::SampleCache::matches(const SegmentationParameters& parameters, bool useGrayscale,
+	int pixelCount) const
+{
+	return isSampled.size() == pixelCount && samplingProbability == parameters.samplingProbability
+		&& strategy == parameters.samplingStrategy && seed == parameters.samplingSeed
+		&& (strategy != Sampler::COLOR_SAMPLING || this->useGrayscale == useGrayscale);
+}
+
+bool DoserModel::SuperpixelCache::matches(const SegmentationParameters& parameters, bool useGrayscale) const
+{
+	return !internalNodes.isEmpty() && superpixelCount == parameters.superpixelCount
+		&& compactness == parameters.superpixelCompactness && this->useGrayscale == useGrayscale;
 }
 
 // segmentation procedures
 
 void DoserModel::doSegment(SegmentationMode mode)
 {
-	if (isSegmenting || image.isNull() || (mode != QUICK_MODE && mode != DEEP_MODE))
+	if (isSegmenting || features.isNull() || mode == BOTH_MODE)
 	{
 		throw;
 	}
 
+	progressMode = mode;
+	if (mode == PYRAMID_MODE)
+	{
+		segmentPyramid();
+		return;
+	}
+	else if (mode == TILED_MODE)
+	{
+		segmentTiles();
+		return;
+	}
+
+	QElapsedTimer timer;
+	timer.start();
+	if (mode == BUDGETED_MODE)
+	{
+		planBudget();
+	}
+
 	initialize(mode);
+	stats.samplingTime += timer.nsecsElapsed() / 1e6;
+
 	solve(mode);
+	if (isCancelled())
+	{
+		abort(mode);
+		return;
+	}
+
 	finalize(mode);
 }
 
+void DoserModel::segmentBoth()
+{
+	if (isSegmenting || features.isNull())
+	{
+		throw;
+	}
+
+	// the sample and the superpixels are prepared here, then shared by both runs
+
+	useGrayscale = features.isGrayscale() || parameters.forceGrayscale;
+	if (parameters.superpixelCount > 0 && !superpixelCache.matches(parameters, useGrayscale))
+	{
+		internalNodes.clear();
+		binMembers.clear();
+		clusterSuperpixels();
+	}
+	else if (parameters.superpixelCount <= 0 && !sampleCache.matches(parameters, useGrayscale, features.size()))
+	{
+		sampleCache = drawSample();
+	}
+
+	// quick mode runs in its own model on a pool thread, deep mode in this one
+
+	DoserModel quickModel;
+	quickModel.cancellation = cancellation;
+	quickModel.features = features;
+	quickModel.sampleCache = sampleCache;
+	quickModel.superpixelCache = superpixelCache;
+
+	// forwarded from the pool thread, to reach the clients before deep mode finishes
+	connect(&quickModel, &DoserModel::segmentationStarted, this, &DoserModel::segmentationStarted, Qt::DirectConnection);
+	connect(&quickModel, &DoserModel::segmentChanged, this, &DoserModel::segmentChanged, Qt::DirectConnection);
+	connect(&quickModel, &DoserModel::segmentationFinished, this, &DoserModel::segmentationFinished, Qt::DirectConnection);
+	connect(&quickModel, &DoserModel::segmentationCancelled, this, &DoserModel::segmentationCancelled, Qt::DirectConnection);
+	connect(&quickModel, &DoserModel::landmarksVerified, this, &DoserModel::landmarksVerified, Qt::DirectConnection);
+	connect(&quickModel, &DoserModel::segmentationProgress, this, &DoserModel::segmentationProgress, Qt::DirectConnection);
+	connect(&quickModel, &DoserModel::subProcessProgress, this, &DoserModel::subProcessProgress, Qt::DirectConnection);
+	connect(&quickModel, &DoserModel::iterationFinished, this, &DoserModel::iterationFinished, Qt::DirectConnection);
+
+	int workerCount = qMax(1, QThreadPool::globalInstance()->maxThreadCount());
+	int quickWorkerCount = qBound(1, qRound(workerCount * parameters.quickWorkerRatio), qMax(1, workerCount - 1));
+	int deepWorkerCount = qMax(1, workerCount - quickWorkerCount);
+
+	const SegmentationParameters& quickParameters = parameters;
+	QFuture<void> quickRun = QtConcurrent::run([&]()
+	{
+		ParallelFor::setWorkerLimit(quickWorkerCount);
+		quickModel.segment(QUICK_MODE, quickParameters);
+		ParallelFor::setWorkerLimit(0);
+	});
+
+	ParallelFor::setWorkerLimit(deepWorkerCount);
+	doSegment(DEEP_MODE);
+	ParallelFor::setWorkerLimit(0);
+	quickRun.waitForFinished();
+}
+
+void DoserModel::planBudget()
+{
+	// With n nodes, the passes cost about BUDGET_PASS_COUNT * n^2 fitness evaluations, and
+	// extrapolating and merging the N pixels about (2 - target ratio) * N * n induced weight
+	// terms, which are slower; the sample is the largest that fits the solving share of the
+	// budget at the throughputs measured for both.
+
+	budgetTimer.start();
+	useGrayscale = features.isGrayscale() || parameters.forceGrayscale;
+	evaluationRate = measureThroughput();
+	linearEvaluationRate = measureLinearThroughput();
+
+	double pixelCount = features.size();
+	double evaluationCount = evaluationRate * parameters.timeBudget * BUDGET_SOLVE_SHARE;
+	double linearFactor = (2 - parameters.targetSegmentationRatio) * pixelCount
+		* evaluationRate / linearEvaluationRate; // in fitness evaluations
+	double nodeCount = (qSqrt(linearFactor * linearFactor + 4 * BUDGET_PASS_COUNT * evaluationCount) - linearFactor)
+		/ (2 * BUDGET_PASS_COUNT);
+
+	parameters.samplingProbability = qBound(qMin(1.0, BUDGET_MINIMAL_NODE_COUNT / pixelCount),
+		nodeCount / pixelCount, 1.0);
+}
+
 void DoserModel::initialize(SegmentationMode mode)
 {
 	// initializing
 
 	isSegmenting = true;
+	restartInstrumentation();
+	useGrayscale = features.isGrayscale() || parameters.forceGrayscale;
+	replicator.setDynamics(parameters.dynamics, parameters.selectionStrength);
 	emit segmentationStarted(mode);
 
 	internalNodes.clear();
 	externalPixels.clear();
 	pendingPixels.clear();
 	weightedSegments.clear();
+	labelMap = LabelMap(features.width(), features.height());
+	binMembers.clear();
 
 	// sampling and filtering
 
-	for (int y = 0; y < image.height(); ++y)
+	if (mode != SPARSE_MODE && parameters.superpixelCount > 0) // every superpixel is a node
 	{
-		for (int x = 0; x < image.width(); ++x)
-		{
-			if (mode == DEEP_MODE
-				|| ((double) qrand() / RAND_MAX) < parameters.samplingProbability)
-			{
-				internalNodes.append(qMakePair(Pixel(x, y), 0));
-			}
-			else
-			{
-				externalPixels.append(Pixel(x, y));
-			}
-		}
+		clusterSuperpixels();
+		return;
 	}
 
+	sample(mode);
+
 	if (internalNodes.isEmpty())
 	{
 		// fall back to deep mode
@@ -110,6 +386,34 @@ void DoserModel::initialize(SegmentationMode mode)
 
 		externalPixels.clear();
 	}
+
+	if (mode == SPARSE_MODE)
+	{
+		spatialOffsets.clear();
+		int radius = parameters.spatialRadius;
+		for (int dy = -radius; dy <= radius; ++dy)
+		{
+			for (int dx = -radius; dx <= radius; ++dx)
+			{
+				if (dx * dx + dy * dy <= radius * radius)
+				{
+					spatialOffsets.append(QPoint(dx, dy));
+				}
+			}
+		}
+
+		pixelStates.fill(EXTERNAL_PIXEL, features.size());
+		for (const Node& internalNode : internalNodes)
+		{
+			pixelStates[features.indexOf(internalNode.first)] = INTERNAL_PIXEL;
+		}
+
+		inducedWeights.fill(0, features.size());
+	}
+	else if (parameters.collapseIdenticalFeatures) // bins ignore the spatial term
+	{
+		collapseInternalNodes();
+	}
 }
 
 void DoserModel::solve(SegmentationMode mode)
@@ -117,12 +421,33 @@ void DoserModel::solve(SegmentationMode mode)
 	// initialize progress tracking
 
 	int segmentedPixelCount = 0;
-	int pixelCount = image.width() * image.height();
+	int pixelCount = features.width() * features.height();
 	int targetPixelCount = parameters.targetSegmentationRatio * pixelCount;
 
+	QElapsedTimer timer;
+	timer.start();
+
+	gatherSampleFeatures();
+	if (mode == SPARSE_MODE)
+	{
+		buildSparseGraph();
+	}
+	else
+	{
+		cacheAffinities();
+	}
+
+	stats.samplingTime += timer.nsecsElapsed() / 1e6;
+	updatePeakNodeBytes();
+
+	WeightedSegment largestRejectedSegment; // budgeted mode, in case no segment is accepted in time
+	Segment largestRejectedPixels;
+	double lastResidual = 0; // of the last peel, reported throttled
+
 	// segmentation loop
 
-	while (segmentedPixelCount < targetPixelCount)
+	while (segmentedPixelCount < targetPixelCount && !isCancelled()
+		&& !(mode == BUDGETED_MODE && isSolvingTimeUp()))
 	{
 		if (internalNodes.isEmpty()) // ineffective extrapolation
 		{
@@ -131,151 +456,358 @@ void DoserModel::solve(SegmentationMode mode)
 
 		// set initial value
 
-		double initialWeight = 1.0 / internalNodes.size();
+		int internalPixelCount = 0;
+		for (const Node& internalNode : internalNodes)
+		{
+			internalPixelCount += multiplicity(internalNode.first);
+		}
+
+		double initialWeight = 1.0 / internalPixelCount;
+		replicator.reset(internalNodes.size());
+		double* initialWeights = replicator.weights();
 		for (int i = 0; i < internalNodes.size(); ++i)
 		{
-			internalNodes[i].second = initialWeight;
+			initialWeights[i] = multiplicity(internalNodes[i].first) * initialWeight;
 		}
 
 		// iteration loop
 
+		timer.restart();
+
 		double dist;
+		double precision = parameters.iterationPrecision;
 		do
 		{
-			QVector<Node> prevInternalNodes(internalNodes);
-			iterate();
-			dist = distance(internalNodes, prevInternalNodes);
-		} while (dist > parameters.iterationPrecision);
+			dist = iterate();
+			if (mode == BUDGETED_MODE)
+			{
+				precision = budgetedPrecision();
+			}
+		} while (dist > precision && !isCancelled());
+
+		if (isCancelled())
+		{
+			break;
+		}
+
+		stats.parameters.iterationPrecision = qMax(stats.parameters.iterationPrecision,
+			precision == std::numeric_limits<double>::infinity() ? dist : precision);
+
+		stats.iterationTime += timer.nsecsElapsed() / 1e6;
+		flushProgress();
+		stats.passCounts.append(replicator.passCount());
+		updatePeakNodeBytes();
+		lastResidual = replicator.residual();
+		if (iterationThrottle.update(segmentedPixelCount, targetPixelCount))
+		{
+			emit iterationFinished(progressMode, replicator.passCount(), lastResidual);
+		}
+
+		timer.restart();
 
-		// extracting the segment
+		// extracting the segment, compacting the remaining nodes in place
 
 		WeightedSegment weightedSegment;
-		QVector<Node> newInternalNodes;
-		for (const Node& internalNode : internalNodes)
+		const double* weights = replicator.weights();
+		QVector<bool> isKept(internalNodes.size());
+		int keptCount = 0;
+		for (int i = 0; i < internalNodes.size(); ++i)
 		{
-			if (internalNode.second > initialWeight)
+			Node& internalNode = internalNodes[i];
+			internalNode.second = weights[i];
+			isKept[i] = internalNode.second <= multiplicity(internalNode.first) * initialWeight;
+
+			if (isKept[i])
 			{
-				weightedSegment.append(internalNode);
+				internalNodes[keptCount++] = internalNode;
 			}
 			else
 			{
-				newInternalNodes.append(internalNode);
+				weightedSegment.append(internalNode.first, internalNode.second);
 			}
 		}
 
-		if (weightedSegment.empty()) // iff nodes is atomic
+		if (weightedSegment.isEmpty()) // iff nodes is atomic
 		{
-			weightedSegment = internalNodes;
+			for (const Node& internalNode : internalNodes)
+			{
+				weightedSegment.append(internalNode.first, internalNode.second);
+			}
+
 			internalNodes.clear();
+			affinities.clear();
+			sparseGraph.clear();
 		}
 		else
 		{
-			internalNodes = newInternalNodes;
+			internalNodes.resize(keptCount);
+			compactSampleFeatures(isKept);
+			if (!affinities.isNull())
+			{
+				affinities.compact(isKept);
+			}
+
+			if (!sparseGraph.isNull())
+			{
+				sparseGraph.compact(isKept);
+			}
 		}
 
 		// calculating the weighted characteristic vector
 
-		double sumOfWeights = 0;
-		for (const QPair<Pixel, double>& weightedPixel : weightedSegment)
+		weightedSegment.normalize();
+		cacheReferenceTerm(weightedSegment);
+
+		// extrapolating
+
+		if (mode == SPARSE_MODE)
 		{
-			sumOfWeights += weightedPixel.second;
+			extrapolateSparse(weightedSegment);
 		}
-
-		for (int i = 0; i < weightedSegment.size(); ++i)
+		else
 		{
-			weightedSegment[i].second /= sumOfWeights;
+			extrapolate(weightedSegment);
 		}
 
-		// extrapolating
-
-		extrapolate(weightedSegment);
+		stats.extrapolationTime += timer.nsecsElapsed() / 1e6;
+		flushProgress();
+		if (isCancelled()) // the extrapolation is incomplete
+		{
+			break;
+		}
 
 		// registering the extended segment
 
-		if (weightedSegment.size() < parameters.minimalSegmentSize)
+		const Segment& segment = toSegment(weightedSegment);
+		if (segment.size() < parameters.minimalSegmentSize)
 		{
-			for (const QPair<Pixel, double>& weightedPixel : weightedSegment)
-			{ // intentionally not Node
-				pendingPixels.append(weightedPixel.first);
+			++stats.rejectedSegmentCount;
+			pendingPixels.append(segment);
+			for (const Pixel& pixel : weightedSegment.pixels())
+			{
+				binMembers.remove(features.indexOf(pixel));
+			}
+
+			if (mode == BUDGETED_MODE && segment.size() > largestRejectedPixels.size())
+			{
+				largestRejectedSegment = weightedSegment;
+				largestRejectedPixels = segment;
 			}
 		}
 		else
 		{
 			weightedSegments.append(weightedSegment);
-			emit segmentChanged(mode, toSegment(weightedSegment));
+
+			LabelMap::Label label = weightedSegments.size();
+			const QVector<LabelMap::Span>& spans = LabelMap::spansOf(segment);
+			for (const LabelMap::Span& span : spans)
+			{
+				labelMap.fill(span, label);
+			}
+
+			emit segmentChanged(mode, label, spans);
 		}
 
 		// progress tracking
 
-		segmentedPixelCount += weightedSegment.size();
-		emit segmentationProgress(segmentedPixelCount, pixelCount);
+		segmentedPixelCount += segment.size();
+		reportSegmentationProgress(segmentedPixelCount, pixelCount);
+	}
+
+	if (mode == BUDGETED_MODE && weightedSegments.isEmpty() && !isCancelled())
+	{
+		provideMergeTarget(largestRejectedSegment, largestRejectedPixels);
+	}
+
+	int current, max;
+	if (iterationThrottle.takePending(current, max))
+	{
+		emit iterationFinished(progressMode, stats.passCounts.last(), lastResidual);
 	}
+
+	flushProgress();
 }
 
 void DoserModel::finalize(SegmentationMode mode)
 {
+	QElapsedTimer timer;
+	timer.start();
+
 	// collect leftover pixels
 
-	pendingPixels.append(externalPixels);
+	if (mode == SPARSE_MODE)
+	{
+		for (const Pixel& externalPixel : externalPixels)
+		{
+			if (pixelStates[features.indexOf(externalPixel)] == EXTERNAL_PIXEL)
+			{
+				pendingPixels.append(externalPixel);
+			}
+		}
+	}
+	else
+	{
+		pendingPixels.append(externalPixels);
+	}
+
 	for (int i = 0; i < internalNodes.size(); ++i)
 	{
-		pendingPixels.append(internalNodes[i].first);
+		int index = features.indexOf(internalNodes[i].first);
+		if (binMembers.contains(index))
+		{
+			pendingPixels.append(binMembers.take(index));
+		}
+		else
+		{
+			pendingPixels.append(internalNodes[i].first);
+		}
 	}
 
+	stats.pendingPixelCount = pendingPixels.size();
+	updatePeakNodeBytes();
+
 	internalNodes.clear();
+	affinities.clear();
+	sparseGraph.clear();
 
 	// merge
 
-	merge();
+	if (mode == BUDGETED_MODE)
+	{
+		fitMergeToBudget();
+	}
+
+	if (mode == SPARSE_MODE)
+	{
+		mergeSparse();
+	}
+	else
+	{
+		merge();
+	}
+
+	pixelStates.clear();
+	inducedWeights.clear();
+	if (isCancelled())
+	{
+		abort(mode);
+		return;
+	}
 
 	// collect final segments and notify clients
 
-	QVector<Segment> segments(weightedSegments.size());
-	for (int i = 0; i < segments.size(); ++i)
+	for (int i = 0; i < weightedSegments.size(); ++i)
 	{
-		segments[i] = toSegment(weightedSegments[i]);
+		labelSegment(weightedSegments[i], i + 1);
 	}
 
-	emit segmentationFinished(mode, segments);
+	stats.mergingTime = timer.nsecsElapsed() / 1e6;
+	stats.weightEvaluationCount = weightEvaluationCount.load();
+
+	flushProgress();
+	emit segmentationFinished(mode, labelMap, stats);
+	isSegmenting = false;
+}
+
+void DoserModel::abort(SegmentationMode mode)
+{
+	// the partial results are dropped, the per-image caches are kept
+
+	internalNodes.clear();
+	externalPixels.clear();
+	pendingPixels.clear();
+	weightedSegments.clear();
+	labelMap = LabelMap();
+	binMembers.clear();
+	affinities.clear();
+	sparseGraph.clear();
+	pixelStates.clear();
+	inducedWeights.clear();
+
+	emit segmentationCancelled(mode);
 	isSegmenting = false;
 }
 
-void DoserModel::iterate()
+double DoserModel::iterate()
 {
-	QVector<Node>& races = internalNodes;
-	int raceCount = races.size();
-	QVector<QFuture<QPair<int, double>>> futureFitnessInfos(raceCount);
+	int raceCount = replicator.size();
+
+	const float* channels[FitnessKernel::MAX_CHANNEL_COUNT];
+	int channelCount = sampleChannelData(channels);
 
-	for (int i = 0; i < raceCount; ++i)
+	bool isCached = affinities.size() == raceCount;
+	bool isSparse = sparseGraph.size() == raceCount;
+
+	const auto& calculateFitnesses = [&](int begin, int end, const double* raceWeightData, double* fitnessData)
 	{
-		const auto& calculateIthFitnessInfo = [=]()
+		if (isCancelled()) // the pass is discarded
+		{
+			return;
+		}
+		else if (isSparse)
+		{
+			sparseGraph.multiply(begin, end, raceWeightData, fitnessData);
+			return;
+		}
+		else if (isCached)
+		{
+			affinities.multiply(begin, end, raceWeightData, fitnessData);
+			return;
+		}
+
+		float query[FitnessKernel::MAX_CHANNEL_COUNT];
+		for (int i = begin; i < end; ++i)
 		{
-			double fitness = 0;
-			for (const Node& rival : races)
+			for (int c = 0; c < channelCount; ++c)
 			{
-				 fitness += rival.second * weight(races[i].first, rival.first);
+				query[c] = channels[c][i];
 			}
 
-			return qMakePair(i, fitness);
-		};
+			fitnessData[i] = FitnessKernel::fitness(channels, channelCount, query,
+				raceWeightData, raceCount, parameters.weightRatioSquare);
+		}
 
-		futureFitnessInfos[i] = QtConcurrent::run(calculateIthFitnessInfo);
-	}
+		weightEvaluationCount.fetchAndAddRelaxed(qint64(end - begin) * raceCount);
+	};
 
-	QVector<double> fitnesses(raceCount, 0);
-	for (int i = 0; i < raceCount; ++i)
+	const auto& calculateAffinities = [&](int j, double* affinityData)
 	{
-		const QPair<int, double>& fitnessInfo = futureFitnessInfos[i].result();
-		fitnesses[fitnessInfo.first] = fitnessInfo.second;
+		if (isSparse)
+		{
+			sparseGraph.row(j, affinityData);
+			return;
+		}
+		else if (isCached)
+		{
+			affinities.row(j, affinityData);
+			return;
+		}
 
-		emit subProcessProgress(ITERATION, i + 1, raceCount + 1);
-	}
+		const auto& calculateChunk = [&](int begin, int end)
+		{
+			for (int i = begin; i < end && !isCancelled(); ++i)
+			{
+				double squareSum = 0;
+				for (int c = 0; c < channelCount; ++c)
+				{
+					double difference = channels[c][i] - channels[c][j];
+					squareSum += difference * difference;
+				}
+
+				affinityData[i] = qExp(-squareSum / parameters.weightRatioSquare);
+			}
+		};
 
-	double overallFitness = product(races, fitnesses);
-	for (int i = 0; i < raceCount; ++i)
+		ParallelFor::run(raceCount, calculateChunk);
+		weightEvaluationCount.fetchAndAddRelaxed(raceCount);
+	};
+
+	const auto& reportProgress = [&](int done)
 	{
-		races[i].second *= fitnesses[i] / overallFitness;
-	}
+		reportSubProcessProgress(ITERATION, done, raceCount + 1);
+	};
+
+	return replicator.iterate(calculateFitnesses, calculateAffinities, reportProgress);
 }
 
 void DoserModel::extrapolate(WeightedSegment& weightedSegment)
@@ -286,150 +818,1652 @@ void DoserModel::extrapolate(WeightedSegment& weightedSegment)
 		return;
 	}
 
-	QVector<QFuture<QPair<int, bool>>> futureExtrapolationInfos(externalCount);
-	for (int i = 0; i < externalCount; ++i)
+	bool isApproximate = parameters.landmarkCount > 0;
+	WeightedSegment landmarkSegment;
+	if (isApproximate)
 	{
-		const auto& calculateIthExtrapolationInfo = [=]()
-		{
-			return qMakePair(i, inducedWeight(weightedSegment, externalPixels[i]) >= 0);
-		};
-
-		futureExtrapolationInfos[i] = QtConcurrent::run(calculateIthExtrapolationInfo);
+		landmarkSegment = landmarksOf(weightedSegment);
 	}
 
-	QVector<Pixel> newExternalPixels;
-	for (int i = 0; i < externalCount; ++i)
-	{
-		const QPair<int, bool>& extrapolationInfo = futureExtrapolationInfos[i].result();
+	const WeightedSegment& landmarks = isApproximate ? landmarkSegment : weightedSegment;
+
+	QVector<bool> extrapolationInfos(externalCount);
+	bool* extrapolationData = extrapolationInfos.data();
+	QAtomicInt mismatchCount(0);
+
+	bool isVerified = isApproximate && parameters.verifyLandmarks;
+	int evaluationsPerPixel = landmarks.members().size() + (isVerified ? weightedSegment.members().size() : 0);
 
-		if (extrapolationInfo.second)
+	const auto& calculateExtrapolationInfos = [&](int begin, int end)
+	{
+		if (isCancelled())
 		{
-			weightedSegment.append(qMakePair(externalPixels[extrapolationInfo.first], 0));
+			return;
 		}
-		else
+
+		for (int i = begin; i < end; ++i)
 		{
-			newExternalPixels.append(externalPixels[extrapolationInfo.first]);
+			extrapolationData[i] = inducedWeight(landmarks, externalPixels.at(i)) >= 0;
+
+			if (isVerified && extrapolationData[i] != (inducedWeight(weightedSegment, externalPixels.at(i)) >= 0))
+			{
+				mismatchCount.ref();
+			}
 		}
 
-		emit subProcessProgress(EXTRAPOLATION, i + 1, externalCount + 1);
-	}
+		weightEvaluationCount.fetchAndAddRelaxed(qint64(end - begin) * evaluationsPerPixel);
+	};
 
-	externalPixels = newExternalPixels;
+	const auto& reportProgress = [&](int done)
+	{
+		reportSubProcessProgress(EXTRAPOLATION, done, externalCount + 1);
+	};
+
+	ParallelFor::run(externalCount, calculateExtrapolationInfos, reportProgress);
+	if (isCancelled())
+	{
+		return;
+	}
+
+	if (isVerified)
+	{
+		stats.landmarkMismatchCount += mismatchCount.load();
+		stats.landmarkDecisionCount += externalCount;
+		emit landmarksVerified(EXTRAPOLATION, mismatchCount.load(), externalCount);
+	}
+
+	QVector<Pixel> newExternalPixels;
+	for (int i = 0; i < externalCount; ++i)
+	{
+		if (extrapolationInfos[i])
+		{
+			weightedSegment.append(externalPixels[i]);
+		}
+		else
+		{
+			newExternalPixels.append(externalPixels[i]);
+		}
+	}
+
+	externalPixels = newExternalPixels;
 }
 
 void DoserModel::merge()
 {
 	int pendingCount = pendingPixels.size();
-	QVector<QFuture<QPair<int, QVector<WeightedSegment>::iterator>>> futureMergeInfos(pendingCount);
+	if (pendingCount == 0 || weightedSegments.isEmpty())
+	{
+		return;
+	}
 
-	for (int i = 0; i < pendingCount; ++i)
+	bool isApproximate = parameters.landmarkCount > 0;
+	QVector<WeightedSegment> landmarks(isApproximate ? weightedSegments.size() : 0);
+	for (int s = 0; s < landmarks.size(); ++s)
 	{
-		const auto& ithSimilarity = [=](const WeightedSegment& s1, const WeightedSegment& s2)
+		landmarks[s] = landmarksOf(weightedSegments[s]);
+	}
+
+	QVector<int> mergeInfos(pendingCount);
+	int* mergeData = mergeInfos.data();
+	QAtomicInt mismatchCount(0);
+
+	bool isVerified = isApproximate && parameters.verifyLandmarks;
+	qint64 evaluationsPerPixel = 0;
+	for (int s = 0; s < weightedSegments.size(); ++s)
+	{
+		evaluationsPerPixel += isApproximate ? landmarks[s].members().size() : weightedSegments[s].members().size();
+		evaluationsPerPixel += isVerified ? weightedSegments[s].members().size() : 0;
+	}
+
+	const auto& calculateMergeInfos = [&](int begin, int end)
+	{
+		if (isCancelled())
 		{
-			return inducedWeight(s1, pendingPixels[i])
-				< inducedWeight(s2, pendingPixels[i]);
-		};
+			return;
+		}
 
-		const auto& calculateIthMergeInfo = [=]()
+		for (int i = begin; i < end; ++i)
 		{
-			return qMakePair(i, std::max_element(weightedSegments.begin(),
-				weightedSegments.end(), ithSimilarity));
-		};
+			mergeData[i] = mostSimilarSegment(isApproximate ? landmarks : weightedSegments, pendingPixels.at(i));
+
+			if (isVerified && mergeData[i] != mostSimilarSegment(weightedSegments, pendingPixels.at(i)))
+			{
+				mismatchCount.ref();
+			}
+		}
+
+		weightEvaluationCount.fetchAndAddRelaxed((end - begin) * evaluationsPerPixel);
+	};
+
+	const auto& reportProgress = [&](int done)
+	{
+		reportSubProcessProgress(MERGING, done, pendingCount + 1);
+	};
+
+	ParallelFor::run(pendingCount, calculateMergeInfos, reportProgress);
+	if (isCancelled())
+	{
+		return;
+	}
 
-		futureMergeInfos[i] = QtConcurrent::run(calculateIthMergeInfo);
+	if (isVerified)
+	{
+		stats.landmarkMismatchCount += mismatchCount.load();
+		stats.landmarkDecisionCount += pendingCount;
+		emit landmarksVerified(MERGING, mismatchCount.load(), pendingCount);
 	}
 
 	for (int i = 0; i < pendingCount; ++i)
 	{
-		const QPair<int, QVector<WeightedSegment>::iterator>& mergeInfo = futureMergeInfos[i].result();
-		mergeInfo.second->append(qMakePair(pendingPixels[mergeInfo.first], 0));
+		weightedSegments[mergeInfos[i]].append(pendingPixels[i]);
+	}
+}
+
+// pyramid mode procedures
+
+void DoserModel::segmentPyramid()
+{
+	// segmenting a downscaled copy in quick mode
+
+	isSegmenting = true;
+	restartInstrumentation();
+	useGrayscale = features.isGrayscale() || parameters.forceGrayscale;
+	emit segmentationStarted(PYRAMID_MODE);
+
+	int levelCount = qMax(0, parameters.pyramidLevelCount);
+	while (levelCount > 0 && ((features.width() >> levelCount) == 0 || (features.height() >> levelCount) == 0))
+	{
+		--levelCount;
+	}
+
+	DoserModel coarseModel;
+	coarseModel.cancellation = cancellation;
+	coarseModel.features = features.scaled(features.width() >> levelCount, features.height() >> levelCount);
+
+	// forwarded as progress of pyramid mode
+	connect(&coarseModel, &DoserModel::segmentationProgress, this,
+		[this](SegmentationMode, int current, int max) { emit segmentationProgress(PYRAMID_MODE, current, max); });
+	connect(&coarseModel, &DoserModel::subProcessProgress, this,
+		[this](SegmentationMode, SubProcessType type, int current, int max)
+		{
+			emit subProcessProgress(PYRAMID_MODE, type, current, max);
+		});
+	connect(&coarseModel, &DoserModel::iterationFinished, this,
+		[this](SegmentationMode, int passCount, double residual)
+		{
+			emit iterationFinished(PYRAMID_MODE, passCount, residual);
+		});
+	connect(&coarseModel, &DoserModel::landmarksVerified, this, &DoserModel::landmarksVerified);
+
+	SegmentationParameters coarseParameters = parameters;
+	coarseParameters.minimalSegmentSize = parameters.minimalSegmentSize / (1 << (2 * levelCount));
+	coarseModel.segment(QUICK_MODE, coarseParameters);
+	if (isCancelled())
+	{
+		abort(PYRAMID_MODE);
+		return;
+	}
+
+	// the counters and timings of the coarse run, under the parameters of this one
+	SegmentationParameters runParameters = stats.parameters;
+	stats = coarseModel.stats;
+	stats.parameters = runParameters;
+	weightEvaluationCount.store(coarseModel.weightEvaluationCount.load());
+
+	QElapsedTimer timer;
+	timer.start();
+
+	// projecting the characteristic vectors to full resolution; their pixels are not kept
+
+	weightedSegments.clear();
+	binMembers.clear();
+	const auto& project = [&](const Pixel& pixel) { return toFullResolution(pixel, levelCount); };
+	for (const WeightedSegment& coarseSegment : coarseModel.weightedSegments)
+	{
+		WeightedSegment weightedSegment = coarseSegment.mapped(project);
+		cacheReferenceTerm(weightedSegment);
+		weightedSegments.append(weightedSegment);
+	}
+
+	QVector<WeightedSegment> landmarks;
+	bool isApproximate = parameters.landmarkCount > 0;
+	for (int s = 0; isApproximate && s < weightedSegments.size(); ++s)
+	{
+		landmarks.append(landmarksOf(weightedSegments[s]));
+	}
+
+	// refining the labels level by level
+
+	labelMap = coarseModel.labelMap;
+	for (int level = levelCount; level > 0 && !isCancelled(); --level)
+	{
+		labelMap = refineLabels(labelMap, level, isApproximate ? landmarks : weightedSegments);
+	}
 
-		emit subProcessProgress(MERGING, i + 1, pendingPixels.size() + 1);
+	if (isCancelled())
+	{
+		abort(PYRAMID_MODE);
+		return;
 	}
+
+	stats.refinementTime = timer.nsecsElapsed() / 1e6;
+	stats.weightEvaluationCount = weightEvaluationCount.load();
+
+	flushProgress();
+	emit segmentationFinished(PYRAMID_MODE, labelMap, stats);
+	isSegmenting = false;
 }
 
-// utility functions
+LabelMap DoserModel::refineLabels(const LabelMap& coarseLabels, int level, const QVector<WeightedSegment>& segments)
+{
+	// a pixel of level - 1 inherits the label of its coarse pixel, unless the 3x3 coarse
+	// neighbourhood is mixed: then the candidate segment of the highest induced weight wins
+
+	int width = qMax(1, features.width() >> (level - 1));
+	int height = qMax(1, features.height() >> (level - 1));
+	QVector<LabelMap::Label> labels(width * height);
+	LabelMap::Label* labelData = labels.data();
+
+	const auto& refineRows = [&](int begin, int end)
+	{
+		qint64 evaluationCount = 0;
+		for (int y = begin; y < end && !isCancelled(); ++y)
+		{
+			int coarseY = qMin(y / 2, coarseLabels.height() - 1);
+			for (int x = 0; x < width; ++x)
+			{
+				int coarseX = qMin(x / 2, coarseLabels.width() - 1);
+				LabelMap::Label label = coarseLabels.label(QPoint(coarseX, coarseY));
+
+				QVarLengthArray<LabelMap::Label, 9> candidates;
+				for (int dy = -1; dy <= 1; ++dy)
+				{
+					for (int dx = -1; dx <= 1; ++dx)
+					{
+						QPoint neighbor(coarseX + dx, coarseY + dy);
+						if (neighbor.x() < 0 || neighbor.y() < 0
+							|| neighbor.x() >= coarseLabels.width() || neighbor.y() >= coarseLabels.height())
+						{
+							continue;
+						}
+
+						LabelMap::Label candidate = coarseLabels.label(neighbor);
+						if (candidate != 0 && !candidates.contains(candidate))
+						{
+							candidates.append(candidate);
+						}
+					}
+				}
+
+				if (candidates.size() > 1 || (candidates.size() == 1 && candidates[0] != label))
+				{
+					const Pixel& pixel = toFullResolution(Pixel(x, y), level - 1);
+					double bestInducedWeight = -std::numeric_limits<double>::infinity();
+
+					for (LabelMap::Label candidate : candidates)
+					{
+						const WeightedSegment& segment = segments.at(candidate - 1);
+						double currentInducedWeight = inducedWeight(segment, pixel);
+						evaluationCount += segment.members().size();
+
+						if (currentInducedWeight > bestInducedWeight)
+						{
+							label = candidate;
+							bestInducedWeight = currentInducedWeight;
+						}
+					}
+				}
+
+				labelData[qint64(y) * width + x] = label;
+			}
+		}
+
+		weightEvaluationCount.fetchAndAddRelaxed(evaluationCount);
+	};
+
+	const auto& reportProgress = [&](int done)
+	{
+		reportSubProcessProgress(REFINEMENT, done, height + 1);
+	};
+
+	ParallelFor::run(height, refineRows, reportProgress);
+	return LabelMap(width, height, labels);
+}
 
-double DoserModel::distance(const QVector<Node>& v1, const QVector<Node>& v2) const
+DoserModel::Pixel DoserModel::toFullResolution(const Pixel& pixel, int level) const
 {
-	if (v1.size() != v2.size())
+	// the centre of the block a pixel of the given level covers
+	int x = qMin((pixel.x() << level) + (1 << level) / 2, features.width() - 1);
+	int y = qMin((pixel.y() << level) + (1 << level) / 2, features.height() - 1);
+	return Pixel(x, y);
+}
+
+// sweep procedures
+
+void DoserModel::doSweep(SegmentationMode mode, const QVector<SegmentationParameters>& grid)
+{
+	if (isSegmenting || features.isNull() || mode == BOTH_MODE || grid.isEmpty())
 	{
 		throw;
 	}
 
-	double sumOfSquares = 0;
-	for (int i = 0; i < v1.size(); ++i)
+	isSegmenting = true;
+	progressMode = mode;
+	parameters = grid.first();
+	restartInstrumentation();
+	emit segmentationStarted(mode);
+
+	// drawing the sample or the superpixels of every distinct setting once, in this thread
+
+	QVector<SampleCache> samples;
+	QVector<SuperpixelCache> superpixelSets;
+	bool isShared = mode == QUICK_MODE || mode == DEEP_MODE || mode == SPARSE_MODE;
+	for (int r = 0; isShared && r < grid.size() && !isCancelled(); ++r)
+	{
+		parameters = grid[r];
+		useGrayscale = features.isGrayscale() || parameters.forceGrayscale;
+
+		if (mode != SPARSE_MODE && parameters.superpixelCount > 0)
+		{
+			bool isClustered = false;
+			for (const SuperpixelCache& superpixelSet : superpixelSets)
+			{
+				isClustered = isClustered || superpixelSet.matches(parameters, useGrayscale);
+			}
+
+			if (!isClustered)
+			{
+				internalNodes.clear();
+				binMembers.clear();
+				clusterSuperpixels();
+				superpixelSets.append(superpixelCache);
+			}
+		}
+		else if (mode != DEEP_MODE)
+		{
+			bool isDrawn = false;
+			for (const SampleCache& sample : samples)
+			{
+				isDrawn = isDrawn || sample.matches(parameters, useGrayscale, features.size());
+			}
+
+			if (!isDrawn)
+			{
+				if (!sampleCache.matches(parameters, useGrayscale, features.size()))
+				{
+					sampleCache = drawSample();
+				}
+
+				samples.append(sampleCache);
+			}
+		}
+	}
+
+	internalNodes.clear();
+	binMembers.clear();
+	parameters = grid.first();
+
+	// segmenting concurrently, each run in its own model
+
+	QSharedPointer<SweepCache> cache(new SweepCache);
+	QVector<SweepResult> results(grid.size());
+	for (int r = 0; r < grid.size(); ++r)
+	{
+		results[r].parameters = grid[r];
+	}
+
+	const auto& segmentRunRange = [&](int begin, int end)
+	{
+		for (int r = begin; r < end && !isCancelled(); ++r)
+		{
+			segmentRun(mode, results[r], samples, superpixelSets, cache);
+		}
+	};
+
+	const auto& reportProgress = [&](int done)
+	{
+		reportSegmentationProgress(done, grid.size());
+	};
+
+	ParallelFor::run(grid.size(), segmentRunRange, reportProgress, 1);
+	if (isCancelled())
 	{
-		sumOfSquares += qPow(v1[i].second - v2[i].second, 2);
+		abort(mode);
+		return;
 	}
 
-	return qSqrt(sumOfSquares);
+	flushProgress();
+	emit sweepFinished(mode, results);
+	isSegmenting = false;
 }
 
-double DoserModel::inducedWeight(const WeightedSegment& weightedSegment, const Pixel& externalPixel) const
+void DoserModel::segmentRun(SegmentationMode mode, SweepResult& result, const QVector<SampleCache>& samples,
+	const QVector<SuperpixelCache>& superpixelSets, const QSharedPointer<SweepCache>& cache) const
 {
-	double inducedWeight = 0;
-	const Pixel& referencePixel = weightedSegment.first().first;
+	DoserModel runModel;
+	runModel.cancellation = cancellation;
+	runModel.features = features;
+	runModel.sweepCache = cache;
+
+	bool runUsesGrayscale = features.isGrayscale() || result.parameters.forceGrayscale;
+	for (const SampleCache& sample : samples)
+	{
+		if (sample.matches(result.parameters, runUsesGrayscale, features.size()))
+		{
+			runModel.sampleCache = sample;
+		}
+	}
 
-	for (const QPair<Pixel, double>& weightedPixel : weightedSegment)
+	for (const SuperpixelCache& superpixelSet : superpixelSets)
 	{
-		inducedWeight += weightedPixel.second * (weight(weightedPixel.first, externalPixel)
-			- weight(weightedPixel.first, referencePixel));
+		if (superpixelSet.matches(result.parameters, runUsesGrayscale))
+		{
+			runModel.superpixelCache = superpixelSet;
+		}
 	}
 
-	return inducedWeight;
+	runModel.segment(mode, result.parameters);
+	result.labelMap = runModel.labelMap;
+	result.stats = runModel.stats;
 }
 
-double DoserModel::product(const QVector<Node>& v1, const QVector<double>& v2) const
+// tiled mode procedures
+
+void DoserModel::segmentTiles()
 {
-	if (v1.size() != v2.size())
+	isSegmenting = true;
+	restartInstrumentation();
+	useGrayscale = features.isGrayscale() || parameters.forceGrayscale;
+	emit segmentationStarted(TILED_MODE);
+
+	int tileSize = qMax(16, parameters.tileSize);
+	int overlap = qBound(0, parameters.tileOverlap, tileSize / 2);
+
+	QVector<Tile> tiles;
+	for (int y = 0; y < features.height(); y += tileSize)
 	{
-		throw;
+		for (int x = 0; x < features.width(); x += tileSize)
+		{
+			Tile tile;
+			tile.core = QRect(x, y, qMin(tileSize, features.width() - x), qMin(tileSize, features.height() - y));
+			tile.rect = tile.core.adjusted(-overlap, -overlap, overlap, overlap)
+				& QRect(0, 0, features.width(), features.height());
+			tiles.append(tile);
+		}
+	}
+
+	// segmenting the tiles concurrently, each in its own quick mode model
+
+	const auto& segmentTileRange = [&](int begin, int end)
+	{
+		for (int t = begin; t < end && !isCancelled(); ++t)
+		{
+			segmentTile(tiles[t]);
+		}
+	};
+
+	const auto& reportProgress = [&](int done)
+	{
+		reportSegmentationProgress(done, tiles.size());
+	};
+
+	ParallelFor::run(tiles.size(), segmentTileRange, reportProgress, 1);
+	if (isCancelled())
+	{
+		abort(TILED_MODE);
+		return;
+	}
+
+	QVector<WeightedSegment> segments;
+	for (Tile& tile : tiles)
+	{
+		tile.labelOffset = segments.size();
+		segments.append(tile.segments);
+		tile.segments.clear();
+
+		stats.samplingTime += tile.stats.samplingTime;
+		stats.iterationTime += tile.stats.iterationTime;
+		stats.extrapolationTime += tile.stats.extrapolationTime;
+		stats.mergingTime += tile.stats.mergingTime;
+		stats.passCounts.append(tile.stats.passCounts);
+		stats.rejectedSegmentCount += tile.stats.rejectedSegmentCount;
+		stats.pendingPixelCount += tile.stats.pendingPixelCount;
+		stats.landmarkMismatchCount += tile.stats.landmarkMismatchCount;
+		stats.landmarkDecisionCount += tile.stats.landmarkDecisionCount;
+		stats.peakNodeBytes = qMax(stats.peakNodeBytes, tile.stats.peakNodeBytes); // of a single tile
+		weightEvaluationCount.fetchAndAddRelaxed(tile.stats.weightEvaluationCount);
+	}
+
+	QElapsedTimer timer;
+	timer.start();
+
+	// merging the tile segments across the seams, labelling the cores
+
+	const QVector<int>& finalLabels = reconcileTiles(tiles, segments);
+	if (isCancelled())
+	{
+		abort(TILED_MODE);
+		return;
+	}
+
+	// a group found only in overlap bands labels no core pixel, so the groups that do are renumbered densely
+
+	QVector<QVector<bool>> coreLabels(tiles.size());
+	const auto& findCoreLabels = [&](int begin, int end)
+	{
+		for (int t = begin; t < end; ++t)
+		{
+			const Tile& tile = tiles.at(t);
+			QVector<bool>& isInCore = coreLabels[t];
+			isInCore.fill(false, tile.labelMap.segmentCount() + 1);
+			for (int y = tile.core.top(); y <= tile.core.bottom(); ++y)
+			{
+				const LabelMap::Label* tileLabels = tile.labelMap.constScanLine(y - tile.rect.top());
+				for (int x = tile.core.left(); x <= tile.core.right(); ++x)
+				{
+					isInCore[tileLabels[x - tile.rect.left()]] = true;
+				}
+			}
+		}
+	};
+
+	ParallelFor::run(tiles.size(), findCoreLabels);
+
+	QVector<LabelMap::Label> denseLabels(segments.size() + 1, 0); // of each group label
+	for (int t = 0; t < tiles.size(); ++t)
+	{
+		for (int label = 1; label < coreLabels[t].size(); ++label)
+		{
+			if (coreLabels[t][label])
+			{
+				denseLabels[finalLabels[tiles[t].labelOffset + label - 1]] = 1;
+			}
+		}
+	}
+
+	LabelMap::Label labelCount = 0;
+	for (int group = 1; group < denseLabels.size(); ++group)
+	{
+		if (denseLabels[group] != 0)
+		{
+			denseLabels[group] = ++labelCount;
+		}
 	}
 
-	double product = 0;
-	for (int i = 0; i < v1.size(); ++i)
+	QVector<LabelMap::Label> labels(features.size(), 0);
+	LabelMap::Label* labelData = labels.data();
+
+	const auto& labelTileRange = [&](int begin, int end)
+	{
+		for (int t = begin; t < end; ++t)
+		{
+			const Tile& tile = tiles.at(t);
+			for (int y = tile.core.top(); y <= tile.core.bottom(); ++y)
+			{
+				const LabelMap::Label* tileLabels = tile.labelMap.constScanLine(y - tile.rect.top());
+				for (int x = tile.core.left(); x <= tile.core.right(); ++x)
+				{
+					LabelMap::Label label = tileLabels[x - tile.rect.left()];
+					labelData[qint64(y) * features.width() + x] = label == 0
+						? 0 : denseLabels.at(finalLabels.at(tile.labelOffset + label - 1));
+				}
+			}
+		}
+	};
+
+	ParallelFor::run(tiles.size(), labelTileRange);
+	labelMap = LabelMap(features.width(), features.height(), labels);
+
+	weightedSegments.clear();
+	binMembers.clear();
+	weightedSegments.resize(labelCount);
+	for (int s = segments.size() - 1; s >= 0; --s) // the first segment of a merged group represents it
 	{
-		product += v1[i].second * v2[i];
+		LabelMap::Label label = denseLabels[finalLabels[s]];
+		if (label != 0)
+		{
+			weightedSegments[label - 1] = segments[s];
+		}
 	}
 
-	return product;
+	stats.reconciliationTime = timer.nsecsElapsed() / 1e6;
+	stats.weightEvaluationCount = weightEvaluationCount.load();
+
+	flushProgress();
+	emit segmentationFinished(TILED_MODE, labelMap, stats);
+	isSegmenting = false;
 }
 
-DoserModel::Segment DoserModel::toSegment(const WeightedSegment& weightedSegment) const
+void DoserModel::segmentTile(Tile& tile) const
 {
-	Segment segment(weightedSegment.size());
-	for (int i = 0; i < weightedSegment.size(); ++i)
+	DoserModel tileModel;
+	tileModel.cancellation = cancellation;
+	tileModel.features = features.copy(tile.rect);
+	tileModel.segment(QUICK_MODE, parameters);
+
+	const QPoint& offset = tile.rect.topLeft();
+	const auto& translate = [&](const Pixel& pixel) { return pixel + offset; };
+	for (const WeightedSegment& segment : tileModel.weightedSegments)
 	{
-		segment[i] = weightedSegment[i].first;
+		tile.segments.append(segment.mapped(translate));
 	}
 
-	return segment;
+	tile.labelMap = tileModel.labelMap;
+	tile.stats = tileModel.stats;
 }
 
-double DoserModel::weight(const Pixel& px1, const Pixel& px2) const
+QVector<int> DoserModel::reconcileTiles(const QVector<Tile>& tiles, const QVector<WeightedSegment>& segments)
 {
-	const QRgb& rgb1 = image.pixel(px1);
-	const QRgb& rgb2 = image.pixel(px2);
+	// segments sharing pixels in the overlap of two tiles are merged if each one's reference pixel
+	// has a non-negative induced weight with respect to the other
 
-	double squareSum;
-	if (isGrayscale || parameters.forceGrayscale)
+	QVector<WeightedSegment> representatives(segments);
+	for (int s = 0; s < representatives.size() && !isCancelled(); ++s)
 	{
-		squareSum = qPow((qGray(rgb1) - qGray(rgb2)) / 255.0, 2);
+		if (parameters.landmarkCount > 0)
+		{
+			representatives[s] = landmarksOf(representatives[s]);
+		}
+
+		cacheReferenceTerm(representatives[s]);
 	}
-	else
+
+	QVector<QPair<int, int>> candidates;
+	for (int a = 0; a < tiles.size() && !isCancelled(); ++a)
+	{
+		for (int b = a + 1; b < tiles.size(); ++b)
+		{
+			const QRect& overlapRect = tiles[a].rect & tiles[b].rect;
+			if (overlapRect.isEmpty())
+			{
+				continue;
+			}
+
+			QSet<QPair<int, int>> pairs;
+			for (int y = overlapRect.top(); y <= overlapRect.bottom(); ++y)
+			{
+				for (int x = overlapRect.left(); x <= overlapRect.right(); ++x)
+				{
+					LabelMap::Label labelA = tiles[a].labelMap.label(QPoint(x, y) - tiles[a].rect.topLeft());
+					LabelMap::Label labelB = tiles[b].labelMap.label(QPoint(x, y) - tiles[b].rect.topLeft());
+					if (labelA != 0 && labelB != 0)
+					{
+						pairs.insert(qMakePair(tiles[a].labelOffset + int(labelA) - 1,
+							tiles[b].labelOffset + int(labelB) - 1));
+					}
+				}
+			}
+
+			for (const QPair<int, int>& pair : pairs)
+			{
+				candidates.append(pair);
+			}
+		}
+	}
+
+	QVector<bool> mergeInfos(candidates.size());
+	bool* mergeData = mergeInfos.data();
+
+	const auto& calculateMergeInfos = [&](int begin, int end)
+	{
+		qint64 evaluationCount = 0;
+		for (int i = begin; i < end && !isCancelled(); ++i)
+		{
+			const WeightedSegment& segmentA = representatives.at(candidates.at(i).first);
+			const WeightedSegment& segmentB = representatives.at(candidates.at(i).second);
+			mergeData[i] = inducedWeight(segmentA, segmentB.referencePixel()) >= 0
+				&& inducedWeight(segmentB, segmentA.referencePixel()) >= 0;
+			evaluationCount += segmentA.members().size() + segmentB.members().size();
+		}
+
+		weightEvaluationCount.fetchAndAddRelaxed(evaluationCount);
+	};
+
+	const auto& reportProgress = [&](int done)
+	{
+		reportSubProcessProgress(MERGING, done, candidates.size() + 1);
+	};
+
+	ParallelFor::run(candidates.size(), calculateMergeInfos, reportProgress);
+
+	// union-find over the merged pairs, then numbering the groups from 1
+
+	QVector<int> parents(segments.size());
+	for (int s = 0; s < parents.size(); ++s)
+	{
+		parents[s] = s;
+	}
+
+	const auto& find = [&](int s)
 	{
-		const QColor& hsv1 = QColor(rgb1).toHsv();
-		const QColor& hsv2 = QColor(rgb2).toHsv();
+		while (parents[s] != s)
+		{
+			parents[s] = parents[parents[s]];
+			s = parents[s];
+		}
+
+		return s;
+	};
+
+	for (int i = 0; i < candidates.size(); ++i)
+	{
+		if (mergeInfos[i])
+		{
+			int rootA = find(candidates[i].first), rootB = find(candidates[i].second);
+			parents[qMax(rootA, rootB)] = qMin(rootA, rootB);
+		}
+	}
 
-		double h1 = hsv1.hueF(), v1 = hsv1.valueF();
-		double h2 = hsv2.hueF(), v2 = hsv2.valueF();
-		double vs1 = v1 * hsv1.saturationF(), vs2 = v2 * hsv2.saturationF();
+	QVector<int> finalLabels(segments.size(), 0);
+	int labelCount = 0;
+	for (int s = 0; s < segments.size(); ++s)
+	{
+		int root = find(s);
+		finalLabels[s] = root == s ? ++labelCount : finalLabels[root];
+	}
+
+	return finalLabels;
+}
 
-		squareSum = qPow(v1 - v2, 2);
-		squareSum += qPow(vs1 * qSin(h1) - vs2 * qSin(h2), 2);
-		squareSum += qPow(vs1 * qCos(h1) - vs2 * qCos(h2), 2);
+// sparse mode procedures
+
+void DoserModel::buildSparseGraph()
+{
+	QVector<int> nodeIndices(features.size(), -1);
+	for (int i = 0; i < internalNodes.size(); ++i)
+	{
+		nodeIndices[features.indexOf(internalNodes[i].first)] = i;
 	}
 
+	const auto& buildRow = [&](int i, QVector<SparseAffinityGraph::Entry>& row)
+	{
+		if (isCancelled()) // the remaining rows stay empty
+		{
+			return;
+		}
+
+		const Pixel& pixel = internalNodes.at(i).first;
+		for (const QPoint& offset : spatialOffsets)
+		{
+			const Pixel& neighbor = pixel + offset;
+			if (features.contains(neighbor))
+			{
+				int j = nodeIndices.at(features.indexOf(neighbor));
+				if (j >= 0)
+				{
+					row.append(SparseAffinityGraph::Entry(j, spatialWeight(pixel, neighbor)));
+				}
+			}
+		}
+
+		weightEvaluationCount.fetchAndAddRelaxed(row.size());
+	};
+
+	// symmetrized, a node has at most twice the row length of edges; if every neighbor within the
+	// radius could overflow the graph, only the strongest neighbors that fit are kept
+
+	qint64 nodeCount = qMax(1, internalNodes.size());
+	int maximalRowLength = parameters.maximalNeighborCount;
+	if (nodeCount * spatialOffsets.size() > SparseAffinityGraph::MAXIMAL_EDGE_COUNT)
+	{
+		int fittingRowLength = qMax<qint64>(1, SparseAffinityGraph::MAXIMAL_EDGE_COUNT / (2 * nodeCount));
+		if (maximalRowLength <= 0 || maximalRowLength > fittingRowLength)
+		{
+			maximalRowLength = fittingRowLength;
+			stats.parameters.maximalNeighborCount = maximalRowLength;
+		}
+	}
+
+	sparseGraph.build(internalNodes.size(), buildRow, maximalRowLength);
+	if (isCancelled())
+	{
+		sparseGraph.clear();
+	}
+}
+
+void DoserModel::extrapolateSparse(WeightedSegment& weightedSegment)
+{
+	// only external pixels within the radius of a member can have a non-negative induced weight
+
+	const Pixel& referencePixel = weightedSegment.referencePixel();
+	double referenceTerm = 0;
+	QVector<int> touchedIndices;
+	qint64 evaluationCount = 0;
+
+	for (const WeightedSegment::Member& weightedPixel : weightedSegment.members())
+	{
+		referenceTerm += weightedPixel.second * spatialWeight(weightedPixel.first, referencePixel);
+
+		for (const QPoint& offset : spatialOffsets)
+		{
+			const Pixel& neighbor = weightedPixel.first + offset;
+			if (!features.contains(neighbor))
+			{
+				continue;
+			}
+
+			int index = features.indexOf(neighbor);
+			if (pixelStates[index] == EXTERNAL_PIXEL)
+			{
+				if (inducedWeights[index] == 0)
+				{
+					touchedIndices.append(index);
+				}
+
+				inducedWeights[index] += weightedPixel.second * spatialWeight(weightedPixel.first, neighbor);
+				++evaluationCount;
+			}
+		}
+	}
+
+	weightEvaluationCount.fetchAndAddRelaxed(evaluationCount + weightedSegment.members().size());
+
+	for (int i = 0; i < touchedIndices.size(); ++i)
+	{
+		int index = touchedIndices[i];
+		if (pixelStates[index] == EXTERNAL_PIXEL && inducedWeights[index] - referenceTerm >= 0)
+		{
+			weightedSegment.append(features.pixelAt(index));
+			pixelStates[index] = SEGMENTED_PIXEL;
+		}
+
+		inducedWeights[index] = 0;
+	}
+
+	reportSubProcessProgress(EXTRAPOLATION, 1, 1);
+}
+
+void DoserModel::mergeSparse()
+{
+	int pendingCount = pendingPixels.size();
+	if (pendingCount == 0 || weightedSegments.isEmpty())
+	{
+		return;
+	}
+
+	// labeling the segmented pixels
+
+	QVector<int> labels(features.size(), -1);
+	QVector<float> memberWeights(features.size(), 0);
+	QVector<double> referenceTerms(weightedSegments.size(), 0);
+
+	for (int s = 0; s < weightedSegments.size(); ++s)
+	{
+		for (const Pixel& pixel : weightedSegments[s].pixels())
+		{
+			labels[features.indexOf(pixel)] = s;
+		}
+
+		const Pixel& referencePixel = weightedSegments[s].referencePixel();
+		for (const WeightedSegment::Member& weightedPixel : weightedSegments[s].members())
+		{
+			memberWeights[features.indexOf(weightedPixel.first)] = weightedPixel.second;
+			referenceTerms[s] += weightedPixel.second * spatialWeight(weightedPixel.first, referencePixel);
+		}
+	}
+
+	// merging by the induced weight of the neighbouring members
+
+	QVector<int> mergeInfos(pendingCount);
+	int* mergeData = mergeInfos.data();
+
+	const auto& calculateMergeInfos = [&](int begin, int end)
+	{
+		qint64 evaluationCount = 0;
+		for (int i = begin; i < end && !isCancelled(); ++i)
+		{
+			const Pixel& pendingPixel = pendingPixels.at(i);
+			QVarLengthArray<QPair<int, double>, 16> candidates;
+
+			for (const QPoint& offset : spatialOffsets)
+			{
+				const Pixel& neighbor = pendingPixel + offset;
+				if (!features.contains(neighbor))
+				{
+					continue;
+				}
+
+				int index = features.indexOf(neighbor);
+				int label = labels.at(index);
+				if (label < 0 || memberWeights.at(index) == 0)
+				{
+					continue;
+				}
+
+				double contribution = memberWeights.at(index) * spatialWeight(neighbor, pendingPixel);
+				++evaluationCount;
+				int c = 0;
+				while (c < candidates.size() && candidates[c].first != label)
+				{
+					++c;
+				}
+
+				if (c == candidates.size())
+				{
+					candidates.append(qMakePair(label, contribution));
+				}
+				else
+				{
+					candidates[c].second += contribution;
+				}
+			}
+
+			int bestSegment = -1;
+			double bestInducedWeight = -std::numeric_limits<double>::infinity();
+			for (const QPair<int, double>& candidate : candidates)
+			{
+				double currentInducedWeight = candidate.second - referenceTerms.at(candidate.first);
+				if (currentInducedWeight > bestInducedWeight)
+				{
+					bestSegment = candidate.first;
+					bestInducedWeight = currentInducedWeight;
+				}
+			}
+
+			mergeData[i] = bestSegment;
+		}
+
+		weightEvaluationCount.fetchAndAddRelaxed(evaluationCount);
+	};
+
+	const auto& reportProgress = [&](int done)
+	{
+		reportSubProcessProgress(MERGING, done, pendingCount + 1);
+	};
+
+	ParallelFor::run(pendingCount, calculateMergeInfos, reportProgress);
+	if (isCancelled())
+	{
+		return;
+	}
+
+	// growing the segments into the pixels without weighted members nearby
+
+	QVector<int> unresolved;
+	for (int i = 0; i < pendingCount; ++i)
+	{
+		if (mergeInfos[i] >= 0)
+		{
+			labels[features.indexOf(pendingPixels[i])] = mergeInfos[i];
+		}
+		else
+		{
+			unresolved.append(i);
+		}
+	}
+
+	const QPoint neighborOffsets[] = { QPoint(1, 0), QPoint(-1, 0), QPoint(0, 1), QPoint(0, -1) };
+	bool isGrowing = true;
+	while (!unresolved.isEmpty() && isGrowing)
+	{
+		isGrowing = false;
+		QVector<int> stillUnresolved;
+
+		for (int i : unresolved)
+		{
+			const Pixel& pendingPixel = pendingPixels[i];
+			int bestLabel = -1;
+			double bestWeight = -1;
+
+			for (const QPoint& offset : neighborOffsets)
+			{
+				const Pixel& neighbor = pendingPixel + offset;
+				if (features.contains(neighbor) && labels[features.indexOf(neighbor)] >= 0)
+				{
+					double currentWeight = weight(pendingPixel, neighbor);
+					weightEvaluationCount.fetchAndAddRelaxed(1);
+					if (currentWeight > bestWeight)
+					{
+						bestLabel = labels[features.indexOf(neighbor)];
+						bestWeight = currentWeight;
+					}
+				}
+			}
+
+			if (bestLabel >= 0)
+			{
+				mergeInfos[i] = bestLabel;
+				labels[features.indexOf(pendingPixel)] = bestLabel;
+				isGrowing = true;
+			}
+			else
+			{
+				stillUnresolved.append(i);
+			}
+		}
+
+		unresolved = stillUnresolved;
+	}
+
+	// registering
+
+	for (int i = 0; i < pendingCount; ++i)
+	{
+		if (mergeInfos[i] < 0) // not connected to any segment, fall back to the dense induced weight
+		{
+			mergeInfos[i] = mostSimilarSegment(weightedSegments, pendingPixels[i]);
+		}
+
+		weightedSegments[mergeInfos[i]].append(pendingPixels[i]);
+	}
+}
+
+// utility functions
+
+void DoserModel::restartInstrumentation()
+{
+	stats = SegmentationStats();
+	stats.parameters = parameters;
+	weightEvaluationCount.store(0);
+
+	segmentationThrottle.setLimits(parameters.progressFrequency, parameters.progressDelta);
+	segmentationThrottle.restart();
+	iterationThrottle.setLimits(parameters.progressFrequency, 0);
+	iterationThrottle.restart();
+	for (ProgressThrottle& subProcessThrottle : subProcessThrottles)
+	{
+		subProcessThrottle.setLimits(parameters.progressFrequency, parameters.progressDelta);
+		subProcessThrottle.restart();
+	}
+}
+
+void DoserModel::sample(SegmentationMode mode)
+{
+	// the draw is kept for the image, and redrawn only if the sampling settings change
+
+	if (mode != DEEP_MODE && !sampleCache.matches(parameters, useGrayscale, features.size()))
+	{
+		sampleCache = drawSample();
+	}
+
+	for (int y = 0; y < features.height(); ++y)
+	{
+		for (int x = 0; x < features.width(); ++x)
+		{
+			if (mode == DEEP_MODE || sampleCache.isSampled.testBit(features.indexOf(Pixel(x, y))))
+			{
+				internalNodes.append(qMakePair(Pixel(x, y), 0));
+			}
+			else
+			{
+				externalPixels.append(Pixel(x, y));
+			}
+		}
+	}
+}
+
+DoserModel::SampleCache DoserModel::drawSample() const
+{
+	SampleCache sample;
+	sample.samplingProbability = parameters.samplingProbability;
+	sample.strategy = parameters.samplingStrategy;
+	sample.seed = parameters.samplingSeed;
+	sample.useGrayscale = useGrayscale;
+
+	// every draw has its own generator, so runs on different threads do not interfere
+	quint32 seed = parameters.samplingSeed != 0 ? parameters.samplingSeed : QRandomGenerator::global()->generate();
+	Sampler sampler(parameters.samplingStrategy, seed);
+	sample.isSampled = sampler.sample(features, useGrayscale, parameters.samplingProbability);
+	return sample;
+}
+
+void DoserModel::cacheAffinities()
+{
+	affinities.clear();
+
+	AffinityMatrix::Precision precision = parameters.halfPrecisionAffinities
+		? AffinityMatrix::HALF_PRECISION : AffinityMatrix::SINGLE_PRECISION;
+	qint64 budgetBytes = parameters.affinityCacheBudget * 1024 * 1024;
+
+	if (!AffinityMatrix::fits(internalNodes.size(), precision, budgetBytes))
+	{
+		return;
+	}
+
+	const auto& build = [&]()
+	{
+		const float* channels[FitnessKernel::MAX_CHANNEL_COUNT];
+		int channelCount = sampleChannelData(channels);
+		affinities.build(channels, channelCount, internalNodes.size(), parameters.weightRatioSquare, precision,
+			cancellation);
+		weightEvaluationCount.fetchAndAddRelaxed(qint64(internalNodes.size()) * internalNodes.size());
+		++stats.affinityBuildCount;
+	};
+
+	if (sweepCache.isNull())
+	{
+		build();
+		return;
+	}
+
+	// the runs of a sweep with equal nodes and kernels share one build, each compacts its own copy
+
+	QSharedPointer<AffinityEntry> entry;
+	{
+		QMutexLocker locker(&sweepCache->mutex);
+		for (const QSharedPointer<AffinityEntry>& candidate : sweepCache->affinities)
+		{
+			if (sharesAffinities(candidate->parameters, parameters))
+			{
+				entry = candidate;
+			}
+		}
+
+		if (entry.isNull())
+		{
+			entry.reset(new AffinityEntry);
+			entry->parameters = parameters;
+			sweepCache->affinities.append(entry);
+		}
+	}
+
+	QMutexLocker locker(&entry->mutex);
+	if (entry->matrix.isNull())
+	{
+		build();
+		entry->matrix = affinities;
+	}
+	else
+	{
+		affinities = entry->matrix;
+	}
+}
+
+void DoserModel::cacheReferenceTerm(WeightedSegment& weightedSegment) const
+{
+	double referenceTerm = 0;
+	for (const WeightedSegment::Member& weightedPixel : weightedSegment.members())
+	{
+		referenceTerm += weightedPixel.second * weight(weightedPixel.first, weightedSegment.referencePixel());
+	}
+
+	weightedSegment.setReferenceTerm(referenceTerm);
+	weightEvaluationCount.fetchAndAddRelaxed(weightedSegment.members().size());
+}
+
+void DoserModel::clusterSuperpixels()
+{
+	// a superpixel is represented by its member closest to the mean, weighted by its size
+
+	if (superpixelCache.matches(parameters, useGrayscale))
+	{
+		internalNodes = superpixelCache.internalNodes;
+		binMembers = superpixelCache.binMembers;
+		return;
+	}
+
+	Superpixels superpixels;
+	superpixels.build(features, useGrayscale, parameters.superpixelCount, parameters.superpixelCompactness,
+		Superpixels::DEFAULT_ITERATION_COUNT, cancellation);
+	if (isCancelled())
+	{
+		return;
+	}
+
+	const QVector<int>& representatives = superpixels.representatives();
+	QVector<Segment> members(representatives.size());
+	for (int i = 0; i < features.size(); ++i)
+	{
+		members[superpixels.clusterOf(i)].append(features.pixelAt(i));
+	}
+
+	internalNodes.reserve(representatives.size());
+	for (int k = 0; k < representatives.size(); ++k)
+	{
+		internalNodes.append(qMakePair(features.pixelAt(representatives[k]), 0));
+		binMembers.insert(representatives[k], members[k]);
+	}
+
+	superpixelCache.superpixelCount = parameters.superpixelCount;
+	superpixelCache.compactness = parameters.superpixelCompactness;
+	superpixelCache.useGrayscale = useGrayscale;
+	superpixelCache.internalNodes = internalNodes;
+	superpixelCache.binMembers = binMembers;
+}
+
+void DoserModel::collapseInternalNodes()
+{
+	QHash<FeatureBuffer::Key, int> binIndices;
+	QVector<Node> bins;
+
+	for (const Node& internalNode : internalNodes)
+	{
+		const FeatureBuffer::Key& key = features.keyOf(features.indexOf(internalNode.first), useGrayscale);
+		int binIndex = binIndices.value(key, -1);
+
+		if (binIndex < 0)
+		{
+			binIndex = bins.size();
+			binIndices.insert(key, binIndex);
+			bins.append(internalNode);
+		}
+
+		binMembers[features.indexOf(bins[binIndex].first)].append(internalNode.first);
+	}
+
+	internalNodes = bins;
+}
+
+void DoserModel::compactSampleFeatures(const QVector<bool>& keep)
+{
+	int channelCount = FeatureBuffer::channelCount(useGrayscale);
+	for (int c = 0; c < channelCount; ++c)
+	{
+		float* channel = sampleChannels[c].data();
+		int keptCount = 0;
+
+		for (int i = 0; i < sampleChannels[c].size(); ++i)
+		{
+			if (keep[i])
+			{
+				channel[keptCount++] = channel[i];
+			}
+		}
+
+		sampleChannels[c].resize(keptCount);
+	}
+}
+
+void DoserModel::gatherSampleFeatures()
+{
+	int channelCount = FeatureBuffer::channelCount(useGrayscale);
+	for (int c = 0; c < channelCount; ++c)
+	{
+		const float* channel = features.channelData(c, useGrayscale);
+		sampleChannels[c].resize(internalNodes.size());
+
+		for (int i = 0; i < internalNodes.size(); ++i)
+		{
+			sampleChannels[c][i] = channel[features.indexOf(internalNodes[i].first)];
+		}
+	}
+}
+
+int DoserModel::sampleChannelData(const float** channels) const
+{
+	int channelCount = FeatureBuffer::channelCount(useGrayscale);
+	for (int c = 0; c < channelCount; ++c)
+	{
+		channels[c] = sampleChannels[c].constData();
+	}
+
+	return channelCount;
+}
+
+double DoserModel::inducedWeight(const WeightedSegment& weightedSegment, const Pixel& externalPixel) const
+{
+	double inducedWeight = 0;
+	for (const WeightedSegment::Member& weightedPixel : weightedSegment.members())
+	{
+		inducedWeight += weightedPixel.second * weight(weightedPixel.first, externalPixel);
+	}
+
+	return inducedWeight - weightedSegment.referenceTerm();
+}
+
+WeightedSegment DoserModel::landmarksOf(const WeightedSegment& weightedSegment) const
+{
+	// farthest-point selection in feature space, starting from the reference pixel;
+	// every weighted member then passes its weight on to its nearest landmark
+
+	const QVector<WeightedSegment::Member>& members = weightedSegment.members();
+	if (members.size() <= parameters.landmarkCount)
+	{
+		return weightedSegment;
+	}
+
+	int memberCount = members.size();
+	QVector<int> memberIndices(memberCount);
+	for (int m = 0; m < memberCount; ++m)
+	{
+		memberIndices[m] = features.indexOf(members[m].first);
+	}
+
+	QVector<int> landmarkMembers;
+	QVector<double> squareDistances(memberCount, std::numeric_limits<double>::infinity());
+	QVector<int> nearestLandmarks(memberCount, 0);
+
+	int nextMember = 0; // the reference pixel, unless its weight vanished
+	while (landmarkMembers.size() < parameters.landmarkCount)
+	{
+		int landmark = landmarkMembers.size();
+		landmarkMembers.append(nextMember);
+
+		double farthestSquareDistance = -1;
+		for (int m = 0; m < memberCount; ++m)
+		{
+			double squareDistance = features.squareDistance(memberIndices[m], memberIndices[nextMember], useGrayscale);
+			if (squareDistance < squareDistances[m])
+			{
+				squareDistances[m] = squareDistance;
+				nearestLandmarks[m] = landmark;
+			}
+
+			if (squareDistances[m] > farthestSquareDistance)
+			{
+				farthestSquareDistance = squareDistances[m];
+				nextMember = m;
+			}
+		}
+
+		if (farthestSquareDistance <= 0) // every member coincides with a landmark
+		{
+			break;
+		}
+	}
+
+	QVector<double> landmarkWeights(landmarkMembers.size(), 0);
+	for (int m = 0; m < memberCount; ++m)
+	{
+		landmarkWeights[nearestLandmarks[m]] += members[m].second;
+	}
+
+	WeightedSegment landmarks;
+	if (members.first().first != weightedSegment.referencePixel())
+	{
+		landmarks.append(weightedSegment.referencePixel());
+	}
+
+	for (int l = 0; l < landmarkMembers.size(); ++l)
+	{
+		landmarks.append(members[landmarkMembers[l]].first, landmarkWeights[l]);
+	}
+
+	cacheReferenceTerm(landmarks);
+	return landmarks;
+}
+
+int DoserModel::mostSimilarSegment(const QVector<WeightedSegment>& segments, const Pixel& pixel) const
+{
+	int bestSegment = 0;
+	double bestInducedWeight = inducedWeight(segments.at(0), pixel);
+
+	for (int s = 1; s < segments.size(); ++s)
+	{
+		double currentInducedWeight = inducedWeight(segments.at(s), pixel);
+		if (currentInducedWeight > bestInducedWeight)
+		{
+			bestSegment = s;
+			bestInducedWeight = currentInducedWeight;
+		}
+	}
+
+	return bestSegment;
+}
+
+int DoserModel::multiplicity(const Pixel& pixel) const
+{
+	const auto& members = binMembers.constFind(features.indexOf(pixel));
+	return members == binMembers.constEnd() ? 1 : members->size();
+}
+
+double DoserModel::spatialWeight(const Pixel& px1, const Pixel& px2) const
+{
+	int dx = px1.x() - px2.x(), dy = px1.y() - px2.y();
+	int squareDistance = dx * dx + dy * dy;
+	if (squareDistance > parameters.spatialRadius * parameters.spatialRadius)
+	{
+		return 0;
+	}
+
+	double squareSum = features.squareDistance(features.indexOf(px1), features.indexOf(px2), useGrayscale);
+	return qExp(-squareSum / parameters.weightRatioSquare - squareDistance / parameters.spatialWeightRatioSquare);
+}
+
+double DoserModel::measureThroughput() const
+{
+	// the fitnesses of evenly spread pixels against each other, as in a pass of iterate()
+
+	int count = qMin<qint64>(features.size(), CALIBRATION_NODE_COUNT);
+	int channelCount = FeatureBuffer::channelCount(useGrayscale);
+	QVector<float> calibrationChannels[FitnessKernel::MAX_CHANNEL_COUNT];
+	const float* channels[FitnessKernel::MAX_CHANNEL_COUNT];
+	for (int c = 0; c < channelCount; ++c)
+	{
+		calibrationChannels[c].resize(count);
+		for (int i = 0; i < count; ++i)
+		{
+			calibrationChannels[c][i] = features.channelData(c, useGrayscale)[qint64(i) * features.size() / count];
+		}
+
+		channels[c] = calibrationChannels[c].constData();
+	}
+
+	QVector<double> weights(count, 1.0 / count);
+	QVector<double> fitnesses(count);
+
+	const auto& calculateFitnesses = [&](int begin, int end)
+	{
+		float query[FitnessKernel::MAX_CHANNEL_COUNT];
+		for (int i = begin; i < end; ++i)
+		{
+			for (int c = 0; c < channelCount; ++c)
+			{
+				query[c] = channels[c][i];
+			}
+
+			fitnesses[i] = FitnessKernel::fitness(channels, channelCount, query,
+				weights.constData(), count, parameters.weightRatioSquare);
+		}
+	};
+
+	QElapsedTimer timer;
+	timer.start();
+	ParallelFor::run(count, calculateFitnesses);
+	double time = qMax(timer.nsecsElapsed() / 1e6, 1e-3);
+	return qint64(count) * count / time;
+}
+
+double DoserModel::measureLinearThroughput() const
+{
+	// the induced weights of evenly spread pixels on each other, as in extrapolate() and merge()
+
+	int count = qMin<qint64>(features.size(), CALIBRATION_NODE_COUNT);
+	QVector<Pixel> pixels(count);
+	for (int i = 0; i < count; ++i)
+	{
+		pixels[i] = features.pixelAt(qint64(i) * features.size() / count);
+	}
+
+	QVector<double> calibrationWeights(count);
+
+	const auto& calculateInducedWeights = [&](int begin, int end)
+	{
+		for (int i = begin; i < end; ++i)
+		{
+			double inducedWeight = 0;
+			for (int j = 0; j < count; ++j)
+			{
+				inducedWeight += weight(pixels.at(j), pixels.at(i)) / count;
+			}
+
+			calibrationWeights[i] = inducedWeight;
+		}
+	};
+
+	QElapsedTimer timer;
+	timer.start();
+	ParallelFor::run(count, calculateInducedWeights);
+	double time = qMax(timer.nsecsElapsed() / 1e6, 1e-3);
+	return qint64(count) * count / time;
+}
+
+double DoserModel::budgetedPrecision() const
+{
+	// kept for the first half of the solving time, then relaxed geometrically; past the deadline
+	// the current pass is the last
+
+	double progress = budgetTimer.nsecsElapsed() / 1e6 / (parameters.timeBudget * BUDGET_SOLVE_SHARE);
+	if (progress >= 1)
+	{
+		return std::numeric_limits<double>::infinity();
+	}
+
+	double relaxation = qPow(BUDGET_PRECISION_RELAXATION, qBound(0.0, 2 * progress - 1, 1.0));
+	return parameters.iterationPrecision * relaxation;
+}
+
+bool DoserModel::isSolvingTimeUp() const
+{
+	return budgetTimer.nsecsElapsed() / 1e6 >= parameters.timeBudget * BUDGET_SOLVE_SHARE;
+}
+
+void DoserModel::fitMergeToBudget()
+{
+	// merging always completes; if comparing every pending pixel with every member would
+	// overrun the rest of the budget, the segments are represented by fewer landmarks
+
+	if (pendingPixels.isEmpty() || weightedSegments.isEmpty())
+	{
+		return;
+	}
+
+	qint64 memberCount = 0;
+	for (const WeightedSegment& weightedSegment : weightedSegments)
+	{
+		memberCount += parameters.landmarkCount > 0
+			? qMin(weightedSegment.members().size(), parameters.landmarkCount) : weightedSegment.members().size();
+	}
+
+	double remainingTime = qMax(0.0, parameters.timeBudget - budgetTimer.nsecsElapsed() / 1e6);
+	double affordableCount = remainingTime * linearEvaluationRate;
+	if (double(pendingPixels.size()) * memberCount <= affordableCount)
+	{
+		return;
+	}
+
+	int landmarkCount = qMax(1, int(affordableCount / (double(pendingPixels.size()) * weightedSegments.size())));
+	parameters.landmarkCount = parameters.landmarkCount > 0 ? qMin(parameters.landmarkCount, landmarkCount) : landmarkCount;
+	stats.parameters.landmarkCount = parameters.landmarkCount;
+}
+
+void DoserModel::provideMergeTarget(const WeightedSegment& rejectedSegment, const Segment& rejectedPixels)
+{
+	// merging labels every pending pixel only if a segment exists: the largest rejected peel, whose
+	// pixels are pending and merge back into it, or else the remaining nodes as a single segment
+
+	if (!rejectedSegment.isEmpty())
+	{
+		--stats.rejectedSegmentCount;
+		weightedSegments.append(rejectedSegment);
+
+		const QVector<LabelMap::Span>& spans = LabelMap::spansOf(rejectedPixels);
+		for (const LabelMap::Span& span : spans)
+		{
+			labelMap.fill(span, 1);
+		}
+
+		emit segmentChanged(BUDGETED_MODE, 1, spans);
+		return;
+	}
+
+	WeightedSegment weightedSegment;
+	for (const Node& internalNode : internalNodes)
+	{
+		weightedSegment.append(internalNode.first, multiplicity(internalNode.first));
+	}
+
+	if (!weightedSegment.isEmpty())
+	{
+		weightedSegment.normalize();
+		cacheReferenceTerm(weightedSegment);
+		weightedSegments.append(weightedSegment);
+		internalNodes.clear(); // their bins stay, to be labelled with the segment
+	}
+}
+
+void DoserModel::reportSegmentationProgress(int current, int max)
+{
+	if (segmentationThrottle.update(current, max))
+	{
+		emit segmentationProgress(progressMode, current, max);
+	}
+}
+
+void DoserModel::reportSubProcessProgress(SubProcessType type, int current, int max)
+{
+	if (subProcessThrottles[type].update(current, max))
+	{
+		emit subProcessProgress(progressMode, type, current, max);
+	}
+}
+
+void DoserModel::flushProgress()
+{
+	int current, max;
+	if (segmentationThrottle.takePending(current, max))
+	{
+		emit segmentationProgress(progressMode, current, max);
+	}
+
+	for (int type = ITERATION; type <= REFINEMENT; ++type)
+	{
+		if (subProcessThrottles[type].takePending(current, max))
+		{
+			emit subProcessProgress(progressMode, static_cast<SubProcessType>(type), current, max);
+		}
+	}
+}
+
+void DoserModel::updatePeakNodeBytes()
+{
+	qint64 bytes = qint64(internalNodes.capacity()) * sizeof(Node)
+		+ qint64(externalPixels.capacity() + pendingPixels.capacity()) * sizeof(Pixel)
+		+ qint64(pixelStates.capacity()) * sizeof(quint8) + qint64(inducedWeights.capacity()) * sizeof(float)
+		+ replicator.bytes() + affinities.bytes() + sparseGraph.bytes();
+
+	for (const QVector<float>& sampleChannel : sampleChannels)
+	{
+		bytes += qint64(sampleChannel.capacity()) * sizeof(float);
+	}
+
+	stats.peakNodeBytes = qMax(stats.peakNodeBytes, bytes);
+}
+
+void DoserModel::labelSegment(const WeightedSegment& weightedSegment, LabelMap::Label label)
+{
+	for (const Pixel& pixel : weightedSegment.pixels())
+	{
+		const auto& members = binMembers.constFind(features.indexOf(pixel));
+		if (members == binMembers.constEnd())
+		{
+			labelMap.setLabel(pixel, label);
+			continue;
+		}
+
+		for (const Pixel& member : *members)
+		{
+			labelMap.setLabel(member, label);
+		}
+	}
+}
+
+DoserModel::Segment DoserModel::toSegment(const WeightedSegment& weightedSegment) const
+{
+	if (binMembers.isEmpty())
+	{
+		return weightedSegment.pixels();
+	}
+
+	Segment segment;
+	for (const Pixel& pixel : weightedSegment.pixels())
+	{
+		const auto& members = binMembers.constFind(features.indexOf(pixel));
+		if (members == binMembers.constEnd())
+		{
+			segment.append(pixel);
+		}
+		else
+		{
+			segment.append(*members);
+		}
+	}
+
+	return segment;
+}
+
+double DoserModel::weight(const Pixel& px1, const Pixel& px2) const
+{
+	double squareSum = features.squareDistance(features.indexOf(px1), features.indexOf(px2), useGrayscale);
 	return qExp(-squareSum / parameters.weightRatioSquare);
 }
@@ -1,21 +1,42 @@
 #ifndef DOSERMODEL_H
 #define DOSERMODEL_H
 
+#include <climits>
+#include <QAtomicInteger>
+#include <QBitArray>
+#include <QElapsedTimer>
+#include <QHash>
 #include <QImage>
+#include <QJsonObject>
 #include <QObject>
 #include <QMap>
+#include <QMutex>
 #include <QPair>
 #include <QPoint>
+#include <QRect>
+#include <QSharedPointer>
+#include <QSize>
 #include <QString>
 
+#include "affinitymatrix.h"
+#include "featurebuffer.h"
+#include "fitnesskernel.h"
+#include "labelmap.h"
+#include "progressthrottle.h"
+#include "replicatorengine.h"
+#include "sampler.h"
+#include "sparseaffinitygraph.h"
+#include "weightedsegment.h"
+
 class DoserModel : public QObject
 {
 	Q_OBJECT
+	friend class DoserBenchmark; // times the individual phases
 
 public:
 	enum SegmentationMode
 	{
-		QUICK_MODE, DEEP_MODE, BOTH_MODE
+		QUICK_MODE, DEEP_MODE, BOTH_MODE, SPARSE_MODE, PYRAMID_MODE, TILED_MODE, BUDGETED_MODE
 	};
 
 	struct SegmentationParameters
@@ -24,62 +45,271 @@ public:
 		double minimalSegmentSize = 50;
 		double iterationPrecision = 0.01;
 		double samplingProbability = 0.1;
+		Sampler::Strategy samplingStrategy = Sampler::UNIFORM_SAMPLING;
+		quint32 samplingSeed = 0; // 0 draws a seed, any other reproduces the sample
 		double weightRatioSquare = 0.01;
 		bool forceGrayscale = false;
+		bool collapseIdenticalFeatures = false;
+		double affinityCacheBudget = 0; // MiB, 0 disables the cache
+		bool halfPrecisionAffinities = false;
+		int spatialRadius = 5; // px, sparse mode only
+		double spatialWeightRatioSquare = 25;
+		int maximalNeighborCount = 0; // 0 keeps every neighbor within the radius, as far as the graph can hold them
+		int landmarkCount = 0; // 0 uses every segment member in extrapolation and merging
+		bool verifyLandmarks = false;
+		ReplicatorEngine::Dynamics dynamics = ReplicatorEngine::REPLICATOR_DYNAMICS;
+		double selectionStrength = 10; // exponential dynamics only
+		double progressFrequency = 30; // Hz, 0 reports every update that passes progressDelta
+		double progressDelta = 1; // percent
+		int pyramidLevelCount = 3; // pyramid mode only, each level halves the resolution
+		int superpixelCount = 0; // 0 segments pixels; otherwise approximate, not in sparse mode
+		double superpixelCompactness = 0.1;
+		int tileSize = 512; // px, tiled mode only
+		int tileOverlap = 16; // px on each side of a tile
+		double timeBudget = 1000; // ms, budgeted mode only
+		double quickWorkerRatio = 0.5; // both mode: share of the workers running quick mode alongside deep mode
+	};
+
+	struct SegmentationStats
+	{
+		SegmentationParameters parameters; // as used; budgeted mode adapts the sampling, precision and landmarks
+		double samplingTime = 0; // ms, building the affinity cache or sparse graph included
+		double iterationTime = 0; // ms
+		double extrapolationTime = 0; // ms
+		double mergingTime = 0; // ms
+		double refinementTime = 0; // ms, pyramid mode only
+		double reconciliationTime = 0; // ms, tiled mode only
+		QVector<int> passCounts; // of each peel
+		qint64 weightEvaluationCount = 0;
+		int affinityBuildCount = 0; // 0 in a sweep run that reused the matrix built by another
+		int rejectedSegmentCount = 0; // smaller than minimalSegmentSize
+		int pendingPixelCount = 0; // when merging
+		int landmarkMismatchCount = 0; // verifyLandmarks only, of extrapolation and merging
+		int landmarkDecisionCount = 0;
+		qint64 peakNodeBytes = 0;
+
+		int peelCount() const { return passCounts.size(); }
+		QJsonObject toJson() const;
+		bool save(const QString& path) const;
+	};
+
+	struct SweepResult
+	{
+		SegmentationParameters parameters;
+		LabelMap labelMap;
+		SegmentationStats stats;
+
+		QJsonObject toJson() const; // the swept parameters and the stats
 	};
 
 	enum SubProcessType
 	{
-		ITERATION, EXTRAPOLATION, MERGING
+		ITERATION, EXTRAPOLATION, MERGING, REFINEMENT
 	};
 
 	typedef QPoint Pixel;
 	typedef QPair<Pixel, double> Node;
 	typedef QVector<Pixel> Segment;
-	typedef QVector<QPair<Pixel, double>> WeightedSegment; // intentionally not QVector<Node>
+
+	static const qint64 FEATURE_STORE_PIXEL_COUNT = 32 * 1024 * 1024; // and above, features are mapped from disk
+	// pixel lists and label maps are Qt 5 containers of at most 2 GiB, pixel lists being the larger
+	static const qint64 MAXIMAL_PIXEL_COUNT = (qint64(INT_MAX) - 64) / sizeof(Pixel);
+	static const int PREVIEW_SIZE = 4096; // px, of images with a feature store
+
+	// planning of budgeted mode
+	static const int CALIBRATION_NODE_COUNT = 1024; // whose fitnesses are timed to measure the throughput
+	static const int BUDGET_PASS_COUNT = 100; // expected iteration passes over the full sample, in all peels
+	static const int BUDGET_MINIMAL_NODE_COUNT = 64;
+	static const double BUDGET_SOLVE_SHARE; // of the time budget, the rest is left to merging
+	static const double BUDGET_PRECISION_RELAXATION; // of the precision at the end of the solving time
 
 	DoserModel();
 
+	// thread-safe: called directly, not queued, while a segmentation occupies the model's thread;
+	// the running segmentation stops within a chunk of work and emits segmentationCancelled(),
+	// a request made while none runs is discarded when the next one starts
+	void cancel();
+
 signals:
-	void imageChanged(QImage image);
+	void imageChanged(QImage image, QSize size); // a preview if smaller than size
+	void imageRejected(QString reason); // the previous image is kept
 	void segmentationStarted(DoserModel::SegmentationMode mode);
-	void segmentChanged(DoserModel::SegmentationMode mode, DoserModel::Segment segment);
-	void segmentationFinished(DoserModel::SegmentationMode mode, QVector<DoserModel::Segment> finalSegments);
-	void segmentationProgress(int current, int max);
-	void subProcessProgress(DoserModel::SubProcessType type, int current, int max);
+	void segmentChanged(DoserModel::SegmentationMode mode, LabelMap::Label label, QVector<LabelMap::Span> spans);
+	void segmentationFinished(DoserModel::SegmentationMode mode, LabelMap labelMap, DoserModel::SegmentationStats stats);
+	void segmentationCancelled(DoserModel::SegmentationMode mode);
+	void sweepFinished(DoserModel::SegmentationMode mode, QVector<DoserModel::SweepResult> results);
+	void segmentationProgress(DoserModel::SegmentationMode mode, int current, int max);
+	void subProcessProgress(DoserModel::SegmentationMode mode, DoserModel::SubProcessType type, int current, int max);
+	void iterationFinished(DoserModel::SegmentationMode mode, int passCount, double residual); // throttled as progress
+	void landmarksVerified(DoserModel::SubProcessType type, int mismatchCount, int decisionCount);
 
 public slots:
 	void openImage(const QString& path);
 	void segment(DoserModel::SegmentationMode mode, DoserModel::SegmentationParameters parameters);
 
+	// Segments the image once for each parameter set, several runs at a time. The runs share the
+	// features, the sample and superpixels of equal settings, and the affinity cache of equal kernels.
+	void sweep(DoserModel::SegmentationMode mode, QVector<DoserModel::SegmentationParameters> grid);
+
 private:
+	// caches of per-image work
+	struct SampleCache
+	{
+		double samplingProbability = -1;
+		Sampler::Strategy strategy = Sampler::UNIFORM_SAMPLING;
+		quint32 seed = 0;
+		bool useGrayscale = false;
+		QBitArray isSampled; // of every pixel
+
+		bool matches(const SegmentationParameters& parameters, bool useGrayscale, int pixelCount) const;
+	};
+
+	struct SuperpixelCache
+	{
+		int superpixelCount = 0;
+		double compactness = 0;
+		bool useGrayscale = false;
+		QVector<Node> internalNodes;
+		QHash<int, Segment> binMembers;
+
+		bool matches(const SegmentationParameters& parameters, bool useGrayscale) const;
+	};
+
 	// segmentation procedures
 	void doSegment(SegmentationMode mode);
+	void segmentBoth();
+	void planBudget();
 	void initialize(SegmentationMode mode);
 	void solve(SegmentationMode mode);
 	void finalize(SegmentationMode mode);
-	void iterate();
+	void abort(SegmentationMode mode);
+	double iterate();
 	void extrapolate(WeightedSegment& weightedSegment);
 	void merge();
 
+	// pyramid mode procedures
+	void segmentPyramid();
+	LabelMap refineLabels(const LabelMap& coarseLabels, int level, const QVector<WeightedSegment>& segments);
+	Pixel toFullResolution(const Pixel& pixel, int level) const;
+
+	// sweep procedures
+	struct AffinityEntry
+	{
+		SegmentationParameters parameters; // those the matrix depends on
+		QMutex mutex; // held while building
+		AffinityMatrix matrix;
+	};
+
+	struct SweepCache
+	{
+		QMutex mutex;
+		QVector<QSharedPointer<AffinityEntry>> affinities;
+	};
+
+	void doSweep(SegmentationMode mode, const QVector<SegmentationParameters>& grid);
+	void segmentRun(SegmentationMode mode, SweepResult& result, const QVector<SampleCache>& samples,
+		const QVector<SuperpixelCache>& superpixelSets, const QSharedPointer<SweepCache>& cache) const;
+
+	// tiled mode procedures
+	struct Tile
+	{
+		QRect rect; // overlapping its neighbours
+		QRect core; // the part labelled by this tile
+		LabelMap labelMap;
+		QVector<WeightedSegment> segments; // characteristic vectors in image coordinates
+		SegmentationStats stats;
+		int labelOffset = 0;
+	};
+
+	void segmentTiles();
+	void segmentTile(Tile& tile) const;
+	QVector<int> reconcileTiles(const QVector<Tile>& tiles, const QVector<WeightedSegment>& segments);
+
+	// sparse mode procedures
+	void buildSparseGraph();
+	void extrapolateSparse(WeightedSegment& weightedSegment);
+	void mergeSparse();
+
 	// utility functions
-	double distance(const QVector<Node>& v1, const QVector<Node>& v2) const;
+	bool isCancelled() const { return cancellation->load() != 0; }
+	void restartInstrumentation();
+	void sample(SegmentationMode mode);
+	SampleCache drawSample() const;
+	void cacheAffinities();
+	void cacheReferenceTerm(WeightedSegment& weightedSegment) const;
+	void clusterSuperpixels();
+	void collapseInternalNodes();
+	void compactSampleFeatures(const QVector<bool>& keep);
+	void gatherSampleFeatures();
+	int sampleChannelData(const float** channels) const;
 	double inducedWeight(const WeightedSegment& weightedSegment, const Pixel& externalPixel) const;
-	double product(const QVector<Node>& v1, const QVector<double>& v2) const;
+	WeightedSegment landmarksOf(const WeightedSegment& weightedSegment) const;
+	int mostSimilarSegment(const QVector<WeightedSegment>& segments, const Pixel& pixel) const;
+	int multiplicity(const Pixel& pixel) const;
+	double spatialWeight(const Pixel& px1, const Pixel& px2) const;
+	void updatePeakNodeBytes();
+	double measureThroughput() const;
+	double measureLinearThroughput() const;
+	double budgetedPrecision() const;
+	bool isSolvingTimeUp() const;
+	void fitMergeToBudget();
+	void provideMergeTarget(const WeightedSegment& rejectedSegment, const Segment& rejectedPixels);
+
+	// progress reporting
+	void reportSegmentationProgress(int current, int max);
+	void reportSubProcessProgress(SubProcessType type, int current, int max);
+	void flushProgress();
+	void labelSegment(const WeightedSegment& weightedSegment, LabelMap::Label label);
 	Segment toSegment(const WeightedSegment& weightedSegment) const;
 	double weight(const Pixel& px1, const Pixel& px2) const;
 
 	// image-related representation
-	QImage image;
-	bool isGrayscale;
+	FeatureBuffer features;
+	bool useGrayscale = false;
 
 	// segmentation-related representation
 	bool isSegmenting = false;
 	SegmentationParameters parameters;
 	QVector<Node> internalNodes;
+	ReplicatorEngine replicator; // weights of internalNodes while iterating
+	QVector<float> sampleChannels[FitnessKernel::MAX_CHANNEL_COUNT]; // features of internalNodes
+	AffinityMatrix affinities; // among internalNodes, if cached
 	QVector<Pixel> externalPixels;
 	QVector<Pixel> pendingPixels;
 	QVector<WeightedSegment> weightedSegments;
+	LabelMap labelMap; // label i + 1 is weightedSegments[i]
+	QHash<int, Segment> binMembers; // pixels represented by a collapsed internal node or a superpixel
+
+	// cancellation, shared with the child models of pyramid and tiled mode
+	QAtomicInt cancellationRequest;
+	const QAtomicInt* cancellation = &cancellationRequest;
+
+	// per-image work reused by later segmentations while its inputs are unchanged
+	SampleCache sampleCache;
+	SuperpixelCache superpixelCache;
+	QSharedPointer<SweepCache> sweepCache; // shared by the runs of a sweep, null otherwise
+
+	// instrumentation
+	SegmentationStats stats;
+	QElapsedTimer budgetTimer; // budgeted mode only
+	double evaluationRate = 0; // weight evaluations per ms in fitnesses, budgeted mode only
+	double linearEvaluationRate = 0; // weight evaluations per ms in induced weights, budgeted mode only
+	mutable QAtomicInteger<qint64> weightEvaluationCount;
+	ProgressThrottle segmentationThrottle;
+	ProgressThrottle iterationThrottle; // of the iterationFinished reports, one per peel otherwise
+	SegmentationMode progressMode = QUICK_MODE; // of the running segmentation or sweep
+	ProgressThrottle subProcessThrottles[REFINEMENT + 1];
+
+	// sparse mode representation
+	enum PixelState
+	{
+		INTERNAL_PIXEL, EXTERNAL_PIXEL, SEGMENTED_PIXEL
+	};
+
+	SparseAffinityGraph sparseGraph; // among internalNodes
+	QVector<QPoint> spatialOffsets;
+	QVector<quint8> pixelStates;
+	QVector<float> inducedWeights;
 };
 
 #endif // DOSERMODEL_H
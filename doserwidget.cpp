@@ -13,12 +13,12 @@
 #include <QPushButton>
 #include <QSpinBox>
 #include <QString>
-#include <QTime>
 #include <QtMath>
 #include <QVBoxLayout>
 
 #include "colorsupplier.h"
 #include "dosermodel.h"
+#include "segmentview.h"
 
 // constructor and destructor
 
@@ -26,7 +26,6 @@ DoserWidget::DoserWidget(QWidget* parent) : QWidget(parent)
 {
 	setupModel();
 	setupGui();
-	qsrand(QTime::currentTime().msec());
 }
 
 DoserWidget::~DoserWidget()
@@ -37,68 +36,128 @@ DoserWidget::~DoserWidget()
 
 // handlers of model events
 
-void DoserWidget::imageChanged(const QImage& image)
+void DoserWidget::imageChanged(const QImage& image, const QSize& size)
 {
-	images[SOURCE] = image;
-	imageLabels[SOURCE]->setPixmap(QPixmap::fromImage(images[SOURCE]));
+	views[SOURCE]->setImage(image, size);
 	resetImages();
 
 	emit status("Image successfully opened.");
 	setControlsEnabled(true);
 }
 
+void DoserWidget::imageRejected(const QString& reason)
+{
+	emit status("Failed to open the image. " + reason);
+	setControlsEnabled(true);
+}
+
 void DoserWidget::segmentationStarted(DoserModel::SegmentationMode mode)
 {
+	++runningCount;
 	setControlsEnabled(false);
-	colorSupplier.reset();
+	colorSuppliers[toGuiElementType(mode)].reset();
 
-	GuiElementType type = toGuiElementType(mode);
-	images[type] = images[SOURCE];
-	imageLabels[type]->setPixmap(QPixmap::fromImage(images[type]));
+	views[toGuiElementType(mode)]->setImage(views[SOURCE]->image(), views[SOURCE]->labelSize());
+	progresses[toGuiElementType(mode)] = 0;
 
 	emit status(toString(mode) + " segmenting image...");
 	mainProgressBar->setFormat("Total segmentation: %p%");
 }
 
-void DoserWidget::drawSegment(DoserModel::SegmentationMode mode, const DoserModel::Segment& segment)
+void DoserWidget::drawSegment(DoserModel::SegmentationMode mode, LabelMap::Label label,
+	const QVector<LabelMap::Span>& spans)
+{
+	Q_UNUSED(label);
+
+	GuiElementType type = toGuiElementType(mode);
+	views[type]->paintSpans(spans, colorSuppliers[type].nextColor().rgb());
+}
+
+void DoserWidget::segmentationFinished(DoserModel::SegmentationMode mode, const LabelMap& labelMap,
+	const DoserModel::SegmentationStats& stats)
 {
 	GuiElementType type = toGuiElementType(mode);
-	QColor color = colorSupplier.nextColor();
+	colorSuppliers[type].reset();
+	QVector<QRgb> palette(labelMap.segmentCount() + 1);
+	for (int label = 1; label < palette.size(); ++label)
+	{
+		palette[label] = colorSuppliers[type].nextColor().rgb();
+	}
+
+	views[type]->paintLabels(labelMap, palette);
+
+	progresses.remove(type);
+	if (progresses.isEmpty())
+	{
+		mainProgressBar->setValue(0);
+		mainProgressBar->setFormat("Total segmentation");
+		subProgressBar->setValue(0);
+		subProgressBar->setFormat("Current subprocess");
+	}
 
-	for (const DoserModel::Pixel& p : segment)
+	double totalTime = stats.samplingTime + stats.iterationTime + stats.extrapolationTime + stats.mergingTime
+		+ stats.refinementTime + stats.reconciliationTime;
+	QString message = QString("Image successfully segmented in %1 s, %2 peels.")
+		.arg(totalTime / 1000, 0, 'f', 1).arg(stats.peelCount());
+	if (mode == DoserModel::BUDGETED_MODE)
 	{
-		images[type].setPixelColor(p, color);
+		message += QString(" Sampled %1, precision %2.")
+			.arg(stats.parameters.samplingProbability, 0, 'g', 2).arg(stats.parameters.iterationPrecision, 0, 'g', 2);
 	}
 
-	imageLabels[type]->setPixmap(QPixmap::fromImage(images[type]));
+	emit status(message);
+	--runningCount;
+	setControlsEnabled(runningCount == 0);
 }
 
-void DoserWidget::segmentationFinished(DoserModel::SegmentationMode mode, const QVector<DoserModel::Segment>& finalSegments)
+void DoserWidget::segmentationCancelled(DoserModel::SegmentationMode mode)
 {
-	colorSupplier.reset();
-	for (const DoserModel::Segment& segment : finalSegments)
+	views[toGuiElementType(mode)]->setText(toString(mode) + " segmentation\ncancelled.");
+
+	progresses.remove(toGuiElementType(mode));
+	if (progresses.isEmpty())
 	{
-		drawSegment(mode, segment);
+		mainProgressBar->setValue(0);
+		mainProgressBar->setFormat("Total segmentation");
+		subProgressBar->setValue(0);
+		subProgressBar->setFormat("Current subprocess");
 	}
 
-	mainProgressBar->setValue(0);
-	mainProgressBar->setFormat("Total segmentation");
-	subProgressBar->setValue(0);
-	subProgressBar->setFormat("Current subprocess");
+	emit status("Segmentation cancelled.");
+	--runningCount;
+	setControlsEnabled(runningCount == 0);
+}
 
-	emit status("Image successfully segmented.");
-	setControlsEnabled(true);
+void DoserWidget::segmentationProgressChanged(DoserModel::SegmentationMode mode, int current, int max)
+{
+	progresses[toGuiElementType(mode)] = qint64(current) * 100 / max;
+
+	int sum = 0;
+	for (int progress : progresses)
+	{
+		sum += progress;
+	}
+
+	mainProgressBar->setValue(sum / progresses.size());
 }
 
-void DoserWidget::segmentationProgressChanged(int current, int max)
+void DoserWidget::subProcessProgressChanged(DoserModel::SegmentationMode mode, DoserModel::SubProcessType type,
+	int current, int max)
 {
-	mainProgressBar->setValue(current * 100 / max);
+	subProgressBar->setFormat("Current " + toString(mode).toLower() + " " + toString(type) + ": %p%");
+	subProgressBar->setValue(qint64(current) * 100 / max);
 }
 
-void DoserWidget::subProcessProgressChanged(DoserModel::SubProcessType type, int current, int max)
+void DoserWidget::landmarksVerified(DoserModel::SubProcessType type, int mismatchCount, int decisionCount)
 {
-	subProgressBar->setFormat("Current " + toString(type) + ": %p%");
-	subProgressBar->setValue(current * 100 / max);
+	emit status(QString("Landmark %1 differed in %2 of %3 decisions.")
+		.arg(toString(type)).arg(mismatchCount).arg(decisionCount));
+}
+
+void DoserWidget::iterationFinished(DoserModel::SegmentationMode mode, int passCount, double residual)
+{
+	emit status(QString("%1 segment converged in %2 passes, residual %3.")
+		.arg(toString(mode)).arg(passCount).arg(residual));
 }
 
 // utility slots
@@ -106,10 +165,19 @@ void DoserWidget::subProcessProgressChanged(DoserModel::SubProcessType type, int
 void DoserWidget::changeGuiMode()
 {
 	DoserModel::SegmentationMode mode = currentMode();
-	bool isQuickVisible = mode == DoserModel::QUICK_MODE || mode == DoserModel::BOTH_MODE;
+	bool isQuickVisible = isSampling(mode);
 	bool isDeepVisible = mode == DoserModel::DEEP_MODE || mode == DoserModel::BOTH_MODE;
 
-	samplingProbabilitySpin->setEnabled(isQuickVisible);
+	samplingProbabilitySpin->setEnabled(isQuickVisible && mode != DoserModel::BUDGETED_MODE);
+	samplingStrategyComboBox->setEnabled(isQuickVisible);
+	spatialRadiusSpin->setEnabled(mode == DoserModel::SPARSE_MODE);
+	maximalNeighborCountSpin->setEnabled(mode == DoserModel::SPARSE_MODE);
+	pyramidLevelCountSpin->setEnabled(mode == DoserModel::PYRAMID_MODE);
+	superpixelCountSpin->setEnabled(mode != DoserModel::SPARSE_MODE);
+	tileSizeSpin->setEnabled(mode == DoserModel::TILED_MODE);
+	timeBudgetSpin->setEnabled(mode == DoserModel::BUDGETED_MODE);
+	affinityCacheSpin->setEnabled(mode != DoserModel::SPARSE_MODE);
+	halfPrecisionCheckBox->setEnabled(mode != DoserModel::SPARSE_MODE);
 	displayGridColumn(QUICK_GROUP_COLUMN_INDEX, isQuickVisible);
 	displayGridColumn(DEEP_GROUP_COLUMN_INDEX, isDeepVisible);
 }
@@ -133,7 +201,7 @@ void DoserWidget::saveImage()
 	if (!savePath.isEmpty() && !savePath.isNull())
 	{
 		GuiElementType type = sender() == saveButtons[QUICK] ? QUICK : DEEP;
-		if (images[type].save(savePath))
+		if (views[type]->image().save(savePath))
 		{
 			emit status("Image successfully saved.");
 		}
@@ -146,15 +214,37 @@ void DoserWidget::saveImage()
 
 void DoserWidget::segment()
 {
+	if (runningCount > 0) // the model's thread is busy, so the request bypasses its event queue
+	{
+		model->cancel();
+		segmentButton->setEnabled(false);
+		emit status("Cancelling segmentation...");
+		return;
+	}
+
 	resetImages();
 
 	DoserModel::SegmentationParameters parameters;
 	parameters.targetSegmentationRatio = targetSegmentationRatioSpin->value() / 100.0;
 	parameters.minimalSegmentSize = minimalSegmentSizeSpin->value();
 	parameters.iterationPrecision = iterationPrecisionSpin->value();
+	parameters.dynamics = static_cast<ReplicatorEngine::Dynamics>(dynamicsComboBox->currentData().toInt());
 	parameters.samplingProbability = samplingProbabilitySpin->value() / 100.0;
+	parameters.samplingStrategy = static_cast<Sampler::Strategy>(samplingStrategyComboBox->currentData().toInt());
 	parameters.weightRatioSquare = qPow(weightRatioSpin->value(), 2);
+	parameters.spatialRadius = spatialRadiusSpin->value();
+	parameters.spatialWeightRatioSquare = qPow(spatialRadiusSpin->value(), 2);
+	parameters.maximalNeighborCount = maximalNeighborCountSpin->value();
+	parameters.pyramidLevelCount = pyramidLevelCountSpin->value();
+	parameters.superpixelCount = superpixelCountSpin->value();
+	parameters.tileSize = tileSizeSpin->value();
+	parameters.timeBudget = timeBudgetSpin->value();
+	parameters.landmarkCount = landmarkCountSpin->value();
+	parameters.verifyLandmarks = verifyLandmarksCheckBox->isChecked();
+	parameters.affinityCacheBudget = affinityCacheSpin->value();
+	parameters.halfPrecisionAffinities = halfPrecisionCheckBox->isChecked();
 	parameters.forceGrayscale = forceGrayscaleCheckBox->isChecked();
+	parameters.collapseIdenticalFeatures = collapseFeaturesCheckBox->isChecked();
 
 	emit doSegment(currentMode(), parameters);
 }
@@ -171,24 +261,32 @@ void DoserWidget::setupModel()
 
 	// image-related
 	connect(this, SIGNAL(doOpenImage(QString)), model, SLOT(openImage(QString)));
-	connect(model, SIGNAL(imageChanged(QImage)),
-		this, SLOT(imageChanged(QImage)));
+	connect(model, SIGNAL(imageChanged(QImage, QSize)),
+		this, SLOT(imageChanged(QImage, QSize)));
+	connect(model, SIGNAL(imageRejected(QString)),
+		this, SLOT(imageRejected(QString)));
 
 	// segmentation-related
 	connect(this, SIGNAL(doSegment(DoserModel::SegmentationMode, DoserModel::SegmentationParameters)),
 		model, SLOT(segment(DoserModel::SegmentationMode, DoserModel::SegmentationParameters)));
 	connect(model, SIGNAL(segmentationStarted(DoserModel::SegmentationMode)),
 		this, SLOT(segmentationStarted(DoserModel::SegmentationMode)));
-	connect(model, SIGNAL(segmentChanged(DoserModel::SegmentationMode, DoserModel::Segment)),
-		this, SLOT(drawSegment(DoserModel::SegmentationMode, DoserModel::Segment)));
-	connect(model, SIGNAL(segmentationFinished(DoserModel::SegmentationMode, QVector<DoserModel::Segment>)),
-		this, SLOT(segmentationFinished(DoserModel::SegmentationMode, QVector<DoserModel::Segment>)));
+	connect(model, SIGNAL(segmentChanged(DoserModel::SegmentationMode, LabelMap::Label, QVector<LabelMap::Span>)),
+		this, SLOT(drawSegment(DoserModel::SegmentationMode, LabelMap::Label, QVector<LabelMap::Span>)));
+	connect(model, SIGNAL(segmentationFinished(DoserModel::SegmentationMode, LabelMap, DoserModel::SegmentationStats)),
+		this, SLOT(segmentationFinished(DoserModel::SegmentationMode, LabelMap, DoserModel::SegmentationStats)));
+	connect(model, SIGNAL(segmentationCancelled(DoserModel::SegmentationMode)),
+		this, SLOT(segmentationCancelled(DoserModel::SegmentationMode)));
 
 	// progress-related
-	connect(model, SIGNAL(segmentationProgress(int, int)),
-		this, SLOT(segmentationProgressChanged(int, int)));
-	connect(model, SIGNAL(subProcessProgress(DoserModel::SubProcessType, int, int)),
-		this, SLOT(subProcessProgressChanged(DoserModel::SubProcessType, int, int)));
+	connect(model, SIGNAL(segmentationProgress(DoserModel::SegmentationMode, int, int)),
+		this, SLOT(segmentationProgressChanged(DoserModel::SegmentationMode, int, int)));
+	connect(model, SIGNAL(subProcessProgress(DoserModel::SegmentationMode, DoserModel::SubProcessType, int, int)),
+		this, SLOT(subProcessProgressChanged(DoserModel::SegmentationMode, DoserModel::SubProcessType, int, int)));
+	connect(model, SIGNAL(landmarksVerified(DoserModel::SubProcessType, int, int)),
+		this, SLOT(landmarksVerified(DoserModel::SubProcessType, int, int)));
+	connect(model, SIGNAL(iterationFinished(DoserModel::SegmentationMode, int, double)),
+		this, SLOT(iterationFinished(DoserModel::SegmentationMode, int, double)));
 
 	modelThread.start();
 }
@@ -285,13 +383,11 @@ QVector<QGroupBox*> DoserWidget::createGuiGroups()
 
 	for (int i = 0; i < guiElementTypes.size(); ++i)
 	{
-		QLabel* label = new QLabel(labelTexts[i]);
-		label->setAlignment(Qt::AlignCenter);
-		label->setScaledContents(true);
-		imageLabels.insert(guiElementTypes[i], label);
+		SegmentView* view = new SegmentView(labelTexts[i]);
+		views.insert(guiElementTypes[i], view);
 
 		QVBoxLayout* layout = new QVBoxLayout;
-		layout->addWidget(label);
+		layout->addWidget(view);
 
 		QGroupBox* group = new QGroupBox(groupTitles[i]);
 		group->setLayout(layout);
@@ -309,6 +405,10 @@ QGroupBox* DoserWidget::createSettingsGui()
 	modeComboBox->addItem("quick", DoserModel::QUICK_MODE);
 	modeComboBox->addItem("deep", DoserModel::DEEP_MODE);
 	modeComboBox->addItem("deep & quick", DoserModel::BOTH_MODE);
+	modeComboBox->addItem("sparse", DoserModel::SPARSE_MODE);
+	modeComboBox->addItem("pyramid", DoserModel::PYRAMID_MODE);
+	modeComboBox->addItem("tiled", DoserModel::TILED_MODE);
+	modeComboBox->addItem("budgeted", DoserModel::BUDGETED_MODE);
 	connect(modeComboBox, SIGNAL(currentIndexChanged(int)), this, SLOT(changeGuiMode()));
 
 	// target ratio
@@ -333,6 +433,15 @@ QGroupBox* DoserWidget::createSettingsGui()
 	iterationPrecisionSpin->setMinimum(0);
 	iterationPrecisionSpin->setSingleStep(0.01);
 	iterationPrecisionSpin->setValue(0.01);
+	iterationPrecisionSpin->setToolTip("A segment has converged once a pass changes its weight vector by less than "
+		"this. Infection-immunization moves one strategy per pass, so it needs more, cheaper passes.");
+
+	// dynamics
+
+	dynamicsComboBox = new QComboBox;
+	dynamicsComboBox->addItem("replicator", ReplicatorEngine::REPLICATOR_DYNAMICS);
+	dynamicsComboBox->addItem("exponential", ReplicatorEngine::EXPONENTIAL_DYNAMICS);
+	dynamicsComboBox->addItem("infection-immunization", ReplicatorEngine::INFECTION_IMMUNIZATION_DYNAMICS);
 
 	// sampling probability
 
@@ -343,6 +452,14 @@ QGroupBox* DoserWidget::createSettingsGui()
 	samplingProbabilitySpin->setSuffix("%");
 	samplingProbabilitySpin->setValue(10);
 
+	// sampling strategy
+
+	samplingStrategyComboBox = new QComboBox;
+	samplingStrategyComboBox->addItem("uniform", Sampler::UNIFORM_SAMPLING);
+	samplingStrategyComboBox->addItem("grid", Sampler::GRID_SAMPLING);
+	samplingStrategyComboBox->addItem("blue noise", Sampler::BLUE_NOISE_SAMPLING);
+	samplingStrategyComboBox->addItem("colors", Sampler::COLOR_SAMPLING);
+
 	// weight ratio
 
 	weightRatioSpin = new QDoubleSpinBox;
@@ -350,11 +467,90 @@ QGroupBox* DoserWidget::createSettingsGui()
 	weightRatioSpin->setSingleStep(0.01);
 	weightRatioSpin->setValue(2);
 
+	// spatial radius
+
+	spatialRadiusSpin = new QSpinBox;
+	spatialRadiusSpin->setRange(1, 50);
+	spatialRadiusSpin->setSingleStep(1);
+	spatialRadiusSpin->setSuffix("px");
+	spatialRadiusSpin->setValue(5);
+
+	// maximal neighbor count
+
+	maximalNeighborCountSpin = new QSpinBox;
+	maximalNeighborCountSpin->setRange(0, 10000);
+	maximalNeighborCountSpin->setSingleStep(8);
+	maximalNeighborCountSpin->setSpecialValueText("all");
+	maximalNeighborCountSpin->setValue(0);
+
+	// pyramid levels
+
+	pyramidLevelCountSpin = new QSpinBox;
+	pyramidLevelCountSpin->setRange(0, 8);
+	pyramidLevelCountSpin->setSingleStep(1);
+	pyramidLevelCountSpin->setValue(3);
+
+	// superpixels
+
+	superpixelCountSpin = new QSpinBox;
+	superpixelCountSpin->setRange(0, 100000);
+	superpixelCountSpin->setSingleStep(500);
+	superpixelCountSpin->setSpecialValueText("off");
+	superpixelCountSpin->setValue(0);
+
+	// tile size
+
+	tileSizeSpin = new QSpinBox;
+	tileSizeSpin->setRange(64, 4096);
+	tileSizeSpin->setSingleStep(64);
+	tileSizeSpin->setSuffix("px");
+	tileSizeSpin->setValue(512);
+
+	// time budget
+
+	timeBudgetSpin = new QSpinBox;
+	timeBudgetSpin->setRange(50, 600000);
+	timeBudgetSpin->setSingleStep(250);
+	timeBudgetSpin->setSuffix("ms");
+	timeBudgetSpin->setValue(1000);
+
+	// landmarks
+
+	landmarkCountSpin = new QSpinBox;
+	landmarkCountSpin->setRange(0, 100000);
+	landmarkCountSpin->setSingleStep(16);
+	landmarkCountSpin->setSpecialValueText("all");
+	landmarkCountSpin->setValue(0);
+
+	// landmark verification
+
+	verifyLandmarksCheckBox = new QCheckBox;
+	verifyLandmarksCheckBox->setChecked(false);
+
+	// affinity cache
+
+	affinityCacheSpin = new QSpinBox;
+	affinityCacheSpin->setRange(0, int(AffinityMatrix::MAXIMAL_BYTES / (1024 * 1024)));
+	affinityCacheSpin->setSingleStep(64);
+	affinityCacheSpin->setSuffix("MiB");
+	affinityCacheSpin->setSpecialValueText("off");
+	affinityCacheSpin->setValue(256);
+
+	// half-precision affinities
+
+	halfPrecisionCheckBox = new QCheckBox;
+	halfPrecisionCheckBox->setChecked(false);
+
 	// force grayscale
 
 	forceGrayscaleCheckBox = new QCheckBox;
 	forceGrayscaleCheckBox->setChecked(false);
 
+	// collapse identical features
+
+	collapseFeaturesCheckBox = new QCheckBox;
+	collapseFeaturesCheckBox->setChecked(false);
+
 	// assembly
 
 	QGridLayout* settingsLayout = new QGridLayout;
@@ -366,13 +562,39 @@ QGroupBox* DoserWidget::createSettingsGui()
 	settingsLayout->addWidget(minimalSegmentSizeSpin, 2, 1);
 	settingsLayout->addWidget(new QLabel("Precision:"), 3, 0);
 	settingsLayout->addWidget(iterationPrecisionSpin, 3, 1);
-	settingsLayout->addWidget(new QLabel("Sampling ratio:"), 4, 0);
-	settingsLayout->addWidget(samplingProbabilitySpin, 4, 1);
-	settingsLayout->addWidget(new QLabel("Weight ratio:"), 5, 0);
-	settingsLayout->addWidget(weightRatioSpin, 5, 1);
-	settingsLayout->addWidget(new QLabel("Force grayscale:"), 6, 0);
-	settingsLayout->addWidget(forceGrayscaleCheckBox, 6, 1);
-	settingsLayout->setRowStretch(7, 1);
+	settingsLayout->addWidget(new QLabel("Dynamics:"), 4, 0);
+	settingsLayout->addWidget(dynamicsComboBox, 4, 1);
+	settingsLayout->addWidget(new QLabel("Sampling ratio:"), 5, 0);
+	settingsLayout->addWidget(samplingProbabilitySpin, 5, 1);
+	settingsLayout->addWidget(new QLabel("Sampling:"), 6, 0);
+	settingsLayout->addWidget(samplingStrategyComboBox, 6, 1);
+	settingsLayout->addWidget(new QLabel("Weight ratio:"), 7, 0);
+	settingsLayout->addWidget(weightRatioSpin, 7, 1);
+	settingsLayout->addWidget(new QLabel("Spatial radius:"), 8, 0);
+	settingsLayout->addWidget(spatialRadiusSpin, 8, 1);
+	settingsLayout->addWidget(new QLabel("Neighbors:"), 9, 0);
+	settingsLayout->addWidget(maximalNeighborCountSpin, 9, 1);
+	settingsLayout->addWidget(new QLabel("Pyramid levels:"), 10, 0);
+	settingsLayout->addWidget(pyramidLevelCountSpin, 10, 1);
+	settingsLayout->addWidget(new QLabel("Superpixels:"), 11, 0);
+	settingsLayout->addWidget(superpixelCountSpin, 11, 1);
+	settingsLayout->addWidget(new QLabel("Tile size:"), 12, 0);
+	settingsLayout->addWidget(tileSizeSpin, 12, 1);
+	settingsLayout->addWidget(new QLabel("Time budget:"), 13, 0);
+	settingsLayout->addWidget(timeBudgetSpin, 13, 1);
+	settingsLayout->addWidget(new QLabel("Landmarks:"), 14, 0);
+	settingsLayout->addWidget(landmarkCountSpin, 14, 1);
+	settingsLayout->addWidget(new QLabel("Verify landmarks:"), 15, 0);
+	settingsLayout->addWidget(verifyLandmarksCheckBox, 15, 1);
+	settingsLayout->addWidget(new QLabel("Affinity cache:"), 16, 0);
+	settingsLayout->addWidget(affinityCacheSpin, 16, 1);
+	settingsLayout->addWidget(new QLabel("Half precision:"), 17, 0);
+	settingsLayout->addWidget(halfPrecisionCheckBox, 17, 1);
+	settingsLayout->addWidget(new QLabel("Force grayscale:"), 18, 0);
+	settingsLayout->addWidget(forceGrayscaleCheckBox, 18, 1);
+	settingsLayout->addWidget(new QLabel("Collapse colors:"), 19, 0);
+	settingsLayout->addWidget(collapseFeaturesCheckBox, 19, 1);
+	settingsLayout->setRowStretch(20, 1);
 
 	QGroupBox* settingsGroup = new QGroupBox("Settings");
 	settingsGroup->setLayout(settingsLayout);
@@ -391,10 +613,8 @@ void DoserWidget::displayGridColumn(int column, bool isVisible)
 
 void DoserWidget::resetImages()
 {
-	images[QUICK] = QImage();
-	images[DEEP] = QImage();
-	imageLabels[QUICK]->setText("Quick segments\nnot yet computed.");
-	imageLabels[DEEP]->setText("Deep segments\nnot yet computed.");
+	views[QUICK]->setText("Quick segments\nnot yet computed.");
+	views[DEEP]->setText("Deep segments\nnot yet computed.");
 }
 
 void DoserWidget::setControlsEnabled(bool enabled)
@@ -403,15 +623,28 @@ void DoserWidget::setControlsEnabled(bool enabled)
 	targetSegmentationRatioSpin->setEnabled(enabled);
 	minimalSegmentSizeSpin->setEnabled(enabled);
 	iterationPrecisionSpin->setEnabled(enabled);
-	samplingProbabilitySpin->setEnabled((currentMode() == DoserModel::QUICK_MODE
-		|| currentMode() == DoserModel::BOTH_MODE) && enabled);
+	dynamicsComboBox->setEnabled(enabled);
+	samplingProbabilitySpin->setEnabled(isSampling(currentMode()) && currentMode() != DoserModel::BUDGETED_MODE && enabled);
+	samplingStrategyComboBox->setEnabled(isSampling(currentMode()) && enabled);
 	weightRatioSpin->setEnabled(enabled);
+	spatialRadiusSpin->setEnabled(currentMode() == DoserModel::SPARSE_MODE && enabled);
+	maximalNeighborCountSpin->setEnabled(currentMode() == DoserModel::SPARSE_MODE && enabled);
+	pyramidLevelCountSpin->setEnabled(currentMode() == DoserModel::PYRAMID_MODE && enabled);
+	superpixelCountSpin->setEnabled(currentMode() != DoserModel::SPARSE_MODE && enabled);
+	tileSizeSpin->setEnabled(currentMode() == DoserModel::TILED_MODE && enabled);
+	timeBudgetSpin->setEnabled(currentMode() == DoserModel::BUDGETED_MODE && enabled);
+	landmarkCountSpin->setEnabled(enabled);
+	verifyLandmarksCheckBox->setEnabled(enabled);
+	affinityCacheSpin->setEnabled(currentMode() != DoserModel::SPARSE_MODE && enabled);
+	halfPrecisionCheckBox->setEnabled(currentMode() != DoserModel::SPARSE_MODE && enabled);
 	forceGrayscaleCheckBox->setEnabled(enabled);
+	collapseFeaturesCheckBox->setEnabled(enabled);
 
-	segmentButton->setEnabled(enabled && !images[SOURCE].isNull());
+	segmentButton->setText(runningCount > 0 ? "Cancel" : "Segmentation");
+	segmentButton->setEnabled(runningCount > 0 || (enabled && !views[SOURCE]->isNull()));
 	openButton->setEnabled(enabled);
-	saveButtons[QUICK]->setEnabled(enabled && !images[QUICK].isNull());
-	saveButtons[DEEP]->setEnabled(enabled && !images[DEEP].isNull());
+	saveButtons[QUICK]->setEnabled(enabled && !views[QUICK]->isNull());
+	saveButtons[DEEP]->setEnabled(enabled && !views[DEEP]->isNull());
 }
 
 // utility functions
@@ -421,9 +654,16 @@ DoserModel::SegmentationMode DoserWidget::currentMode() const
 	return static_cast<DoserModel::SegmentationMode>(modeComboBox->currentData().toInt());
 }
 
+bool DoserWidget::isSampling(DoserModel::SegmentationMode mode) const
+{
+	return mode == DoserModel::QUICK_MODE || mode == DoserModel::BOTH_MODE || mode == DoserModel::SPARSE_MODE
+		|| mode == DoserModel::PYRAMID_MODE || mode == DoserModel::TILED_MODE || mode == DoserModel::BUDGETED_MODE;
+}
+
 DoserWidget::GuiElementType DoserWidget::toGuiElementType(DoserModel::SegmentationMode mode) const
 {
-	if (mode == DoserModel::QUICK_MODE)
+	if (mode == DoserModel::QUICK_MODE || mode == DoserModel::SPARSE_MODE || mode == DoserModel::PYRAMID_MODE
+		|| mode == DoserModel::TILED_MODE || mode == DoserModel::BUDGETED_MODE)
 	{
 		return QUICK;
 	}
@@ -439,6 +679,14 @@ QString DoserWidget::toString(DoserModel::SegmentationMode mode) const
 		return "Quick";
 	case DoserModel::DEEP_MODE:
 		return "Deep";
+	case DoserModel::SPARSE_MODE:
+		return "Sparse";
+	case DoserModel::PYRAMID_MODE:
+		return "Pyramid";
+	case DoserModel::TILED_MODE:
+		return "Tiled";
+	case DoserModel::BUDGETED_MODE:
+		return "Budgeted";
 	default:
 		return "";
 	}
@@ -454,6 +702,8 @@ QString DoserWidget::toString(DoserModel::SubProcessType type) const
 		return "extrapolation";
 	case DoserModel::MERGING:
 		return "merging";
+	case DoserModel::REFINEMENT:
+		return "refinement";
 	default:
 		return "subprocess";
 	}
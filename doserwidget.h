@@ -19,6 +19,7 @@
 
 #include "colorsupplier.h"
 #include "dosermodel.h"
+#include "segmentview.h"
 
 class DoserWidget : public QWidget
 {
@@ -43,12 +44,17 @@ signals:
 
 private slots:
 	// handlers of model events
-	void imageChanged(const QImage& image);
+	void imageChanged(const QImage& image, const QSize& size);
+	void imageRejected(const QString& reason);
 	void segmentationStarted(DoserModel::SegmentationMode mode);
-	void drawSegment(DoserModel::SegmentationMode mode, const DoserModel::Segment& segment);
-	void segmentationFinished(DoserModel::SegmentationMode mode, const QVector<DoserModel::Segment>& finalSegments);
-	void segmentationProgressChanged(int current, int max);
-	void subProcessProgressChanged(DoserModel::SubProcessType type, int current, int max);
+	void drawSegment(DoserModel::SegmentationMode mode, LabelMap::Label label, const QVector<LabelMap::Span>& spans);
+	void segmentationFinished(DoserModel::SegmentationMode mode, const LabelMap& labelMap,
+		const DoserModel::SegmentationStats& stats);
+	void segmentationCancelled(DoserModel::SegmentationMode mode);
+	void segmentationProgressChanged(DoserModel::SegmentationMode mode, int current, int max);
+	void subProcessProgressChanged(DoserModel::SegmentationMode mode, DoserModel::SubProcessType type, int current, int max);
+	void landmarksVerified(DoserModel::SubProcessType type, int mismatchCount, int decisionCount);
+	void iterationFinished(DoserModel::SegmentationMode mode, int passCount, double residual);
 
 	// utility slots
 	void changeGuiMode();
@@ -70,6 +76,7 @@ private:
 
 	// utility functions
 	DoserModel::SegmentationMode currentMode() const;
+	bool isSampling(DoserModel::SegmentationMode mode) const;
 	GuiElementType toGuiElementType(DoserModel::SegmentationMode mode) const;
 	QString toString(DoserModel::SegmentationMode mode) const;
 	QString toString(DoserModel::SubProcessType type) const;
@@ -77,23 +84,37 @@ private:
 	// model-related attributes
 	DoserModel* model;
 	QThread modelThread;
+	int runningCount = 0; // of segmentations, both mode runs two at once; the segment button cancels meanwhile
 
 	// display-related attributes
 	QGridLayout* gridLayout;
-	QMap<GuiElementType, QImage> images;
-	QMap<GuiElementType, QLabel*> imageLabels;
+	QMap<GuiElementType, SegmentView*> views;
 	QProgressBar* mainProgressBar;
 	QProgressBar* subProgressBar;
-	ColorSupplier colorSupplier;
+	QMap<GuiElementType, int> progresses; // percent, of the running segmentations; the main bar shows their mean
+	QMap<GuiElementType, ColorSupplier> colorSuppliers;
 
 	// controls
 	QComboBox* modeComboBox;
 	QSpinBox* targetSegmentationRatioSpin;
 	QSpinBox* minimalSegmentSizeSpin;
 	QDoubleSpinBox* iterationPrecisionSpin;
+	QComboBox* dynamicsComboBox;
 	QDoubleSpinBox* samplingProbabilitySpin;
+	QComboBox* samplingStrategyComboBox;
 	QDoubleSpinBox* weightRatioSpin;
+	QSpinBox* spatialRadiusSpin;
+	QSpinBox* maximalNeighborCountSpin;
+	QSpinBox* pyramidLevelCountSpin;
+	QSpinBox* superpixelCountSpin;
+	QSpinBox* tileSizeSpin;
+	QSpinBox* timeBudgetSpin;
+	QSpinBox* landmarkCountSpin;
+	QCheckBox* verifyLandmarksCheckBox;
+	QSpinBox* affinityCacheSpin;
+	QCheckBox* halfPrecisionCheckBox;
 	QCheckBox* forceGrayscaleCheckBox;
+	QCheckBox* collapseFeaturesCheckBox;
 	QPushButton* segmentButton;
 	QPushButton* openButton;
 	QMap<GuiElementType, QPushButton*> saveButtons;
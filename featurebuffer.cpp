@@ -0,0 +1,272 @@
+#include "featurebuffer.h"
+
+#include <QColor>
+#include <QCryptographicHash>
+#include <QDateTime>
+#include <QFileInfo>
+#include <QImageReader>
+#include <QtMath>
+
+#include "parallelfor.h"
+
+namespace
+{
+	const char STORE_MAGIC[8] = { 'D', 'O', 'S', 'E', 'R', 'F', 'B', '1' };
+
+	struct StoreHeader
+	{
+		char magic[8];
+		quint32 width;
+		quint32 height;
+		quint32 grayscale;
+	};
+}
+
+const int FeatureBuffer::STORE_HEADER_SIZE;
+const int FeatureBuffer::STORE_BAND_HEIGHT;
+
+FeatureBuffer::FeatureBuffer(const QImage& image)
+	: grayscale(image.isGrayscale()) // expensive call
+{
+	float* targetPlanes[PLANE_COUNT];
+	allocate(image.width(), image.height(), targetPlanes);
+	convert(image, targetPlanes, 0);
+}
+
+// feature stores
+
+FeatureBuffer FeatureBuffer::fromStore(const QString& imagePath, const QString& storePath)
+{
+	const FeatureBuffer& store = mapStore(storePath);
+	if (!store.isNull() || !writeStore(imagePath, storePath))
+	{
+		return store;
+	}
+
+	return mapStore(storePath);
+}
+
+QString FeatureBuffer::storeNameOf(const QString& imagePath)
+{
+	QFileInfo info(imagePath);
+	QString identity = info.canonicalFilePath() + "\n" + QString::number(info.size())
+		+ "\n" + QString::number(info.lastModified().toMSecsSinceEpoch());
+
+	const QByteArray& hash = QCryptographicHash::hash(identity.toUtf8(), QCryptographicHash::Sha1);
+	return QString::fromLatin1(hash.toHex()) + ".features";
+}
+
+bool FeatureBuffer::writeStore(const QString& imagePath, const QString& storePath)
+{
+	QImageReader reader(imagePath);
+	QSize imageSize = reader.size();
+	if (!imageSize.isValid())
+	{
+		return false;
+	}
+
+	// the planes are filled through a writable mapping of a temporary file, then renamed
+
+	qint64 pixelCount = qint64(imageSize.width()) * imageSize.height();
+	qint64 storeSize = STORE_HEADER_SIZE + PLANE_COUNT * pixelCount * qint64(sizeof(float));
+
+	QFile file(storePath + ".part");
+	if (!file.open(QIODevice::ReadWrite | QIODevice::Truncate) || !file.resize(storeSize))
+	{
+		return false;
+	}
+
+	uchar* data = file.map(0, storeSize);
+	if (!data)
+	{
+		file.remove();
+		return false;
+	}
+
+	float* targetPlanes[PLANE_COUNT];
+	for (int p = 0; p < PLANE_COUNT; ++p)
+	{
+		targetPlanes[p] = reinterpret_cast<float*>(data + STORE_HEADER_SIZE) + p * pixelCount;
+	}
+
+	// Qt decoders cannot resume a clipped read, so a band-wise decode would restart from the top
+	// for every band; the image is decoded once and converted band by band instead
+
+	const QImage& image = reader.read();
+	bool isDecoded = !image.isNull() && image.size() == imageSize;
+	bool isGrayscale = isDecoded && image.isGrayscale();
+	for (int y = 0; y < imageSize.height() && isDecoded; y += STORE_BAND_HEIGHT)
+	{
+		const QImage& band = image.copy(0, y, imageSize.width(), qMin(STORE_BAND_HEIGHT, imageSize.height() - y));
+		convert(band, targetPlanes, qint64(y) * imageSize.width());
+	}
+
+	StoreHeader header;
+	std::memcpy(header.magic, STORE_MAGIC, sizeof(header.magic));
+	header.width = imageSize.width();
+	header.height = imageSize.height();
+	header.grayscale = isGrayscale;
+	std::memcpy(data, &header, sizeof(header));
+
+	file.unmap(data);
+	file.close();
+
+	if (!isDecoded)
+	{
+		file.remove();
+		return false;
+	}
+
+	QFile::remove(storePath);
+	return QFile::rename(storePath + ".part", storePath);
+}
+
+FeatureBuffer FeatureBuffer::mapStore(const QString& storePath)
+{
+	QSharedPointer<QFile> file(new QFile(storePath));
+	if (!file->open(QIODevice::ReadOnly) || file->size() < STORE_HEADER_SIZE)
+	{
+		return FeatureBuffer();
+	}
+
+	uchar* data = file->map(0, file->size());
+	if (!data)
+	{
+		return FeatureBuffer();
+	}
+
+	StoreHeader header;
+	std::memcpy(&header, data, sizeof(header));
+	qint64 pixelCount = qint64(header.width) * header.height;
+	if (std::memcmp(header.magic, STORE_MAGIC, sizeof(header.magic)) != 0 || pixelCount <= 0
+		|| file->size() != STORE_HEADER_SIZE + PLANE_COUNT * pixelCount * qint64(sizeof(float)))
+	{
+		return FeatureBuffer();
+	}
+
+	FeatureBuffer store;
+	store.w = header.width;
+	store.h = header.height;
+	store.grayscale = header.grayscale != 0;
+	for (int p = 0; p < PLANE_COUNT; ++p)
+	{
+		store.planes[p] = reinterpret_cast<const float*>(data + STORE_HEADER_SIZE) + p * pixelCount;
+	}
+
+	store.storeFile = file;
+	return store;
+}
+
+// derived buffers
+
+FeatureBuffer FeatureBuffer::copy(const QRect& rect) const
+{
+	const QRect& clippedRect = rect & QRect(0, 0, w, h);
+
+	FeatureBuffer buffer;
+	buffer.grayscale = grayscale;
+	float* targetPlanes[PLANE_COUNT];
+	buffer.allocate(clippedRect.width(), clippedRect.height(), targetPlanes);
+
+	for (int p = 0; p < PLANE_COUNT; ++p)
+	{
+		float* target = targetPlanes[p];
+		for (int y = clippedRect.top(); y <= clippedRect.bottom(); ++y)
+		{
+			const float* source = planes[p] + qint64(y) * w + clippedRect.left();
+			std::memcpy(target, source, clippedRect.width() * sizeof(float));
+			target += clippedRect.width();
+		}
+	}
+
+	return buffer;
+}
+
+FeatureBuffer FeatureBuffer::scaled(int width, int height) const
+{
+	FeatureBuffer buffer;
+	buffer.grayscale = grayscale;
+	float* targetPlanes[PLANE_COUNT];
+	buffer.allocate(width, height, targetPlanes);
+
+	const auto& averageRows = [&](int begin, int end)
+	{
+		for (int y = begin; y < end; ++y)
+		{
+			int top = qint64(y) * h / height, bottom = qMax(top + 1, int(qint64(y + 1) * h / height));
+			for (int x = 0; x < width; ++x)
+			{
+				int left = qint64(x) * w / width, right = qMax(left + 1, int(qint64(x + 1) * w / width));
+				double sums[PLANE_COUNT] = {};
+
+				for (int sourceY = top; sourceY < bottom; ++sourceY)
+				{
+					for (int sourceX = left; sourceX < right; ++sourceX)
+					{
+						for (int p = 0; p < PLANE_COUNT; ++p)
+						{
+							sums[p] += planes[p][qint64(sourceY) * w + sourceX];
+						}
+					}
+				}
+
+				int blockSize = (bottom - top) * (right - left);
+				for (int p = 0; p < PLANE_COUNT; ++p)
+				{
+					targetPlanes[p][qint64(y) * width + x] = sums[p] / blockSize;
+				}
+			}
+		}
+	};
+
+	ParallelFor::run(height, averageRows);
+	return buffer;
+}
+
+// utility functions
+
+void FeatureBuffer::convert(const QImage& image, float* const* targetPlanes, qint64 offset)
+{
+	int width = image.width();
+	float* valueBuffer = targetPlanes[VALUE_PLANE] + offset;
+	float* hueSineBuffer = targetPlanes[HUE_SINE_PLANE] + offset;
+	float* hueCosineBuffer = targetPlanes[HUE_COSINE_PLANE] + offset;
+	float* grayBuffer = targetPlanes[GRAY_PLANE] + offset;
+
+	const QImage& rgbImage = image.convertToFormat(QImage::Format_RGB32);
+	const auto& convertRows = [&](int begin, int end)
+	{
+		for (int y = begin; y < end; ++y)
+		{
+			const QRgb* line = reinterpret_cast<const QRgb*>(rgbImage.constScanLine(y));
+			for (int x = 0; x < width; ++x)
+			{
+				qint64 i = qint64(y) * width + x;
+				const QColor& hsv = QColor(line[x]).toHsv();
+
+				double hue = hsv.hueF(), value = hsv.valueF();
+				double vs = value * hsv.saturationF();
+
+				valueBuffer[i] = value;
+				hueSineBuffer[i] = vs * qSin(hue);
+				hueCosineBuffer[i] = vs * qCos(hue);
+				grayBuffer[i] = qGray(line[x]) / 255.0;
+			}
+		}
+	};
+
+	ParallelFor::run(image.height(), convertRows);
+}
+
+void FeatureBuffer::allocate(int width, int height, float** targetPlanes)
+{
+	w = width;
+	h = height;
+
+	for (int p = 0; p < PLANE_COUNT; ++p)
+	{
+		storage[p].resize(size());
+		targetPlanes[p] = storage[p].data();
+		planes[p] = targetPlanes[p];
+	}
+}
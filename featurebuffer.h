@@ -0,0 +1,120 @@
+#ifndef FEATUREBUFFER_H
+#define FEATUREBUFFER_H
+
+#include <cstring>
+#include <QFile>
+#include <QImage>
+#include <QPair>
+#include <QPoint>
+#include <QRect>
+#include <QSharedPointer>
+#include <QString>
+#include <QVector>
+
+class FeatureBuffer
+{
+public:
+	typedef QPair<quint64, quint32> Key; // bit pattern of the feature channels
+
+	static const int STORE_HEADER_SIZE = 64; // bytes, followed by the planes
+	static const int STORE_BAND_HEIGHT = 256; // rows converted at once
+
+	FeatureBuffer() = default;
+	explicit FeatureBuffer(const QImage& image);
+
+	// Maps the on-disk feature store at storePath, building it first if it is missing: the image
+	// is decoded once, so it must fit in memory at 4 bytes per pixel. Null on failure.
+	static FeatureBuffer fromStore(const QString& imagePath, const QString& storePath);
+
+	// a store file name unique to the path, size and modification time of the image
+	static QString storeNameOf(const QString& imagePath);
+
+	// in-memory copies of the features of a part of the image, or of block averages of them
+	FeatureBuffer copy(const QRect& rect) const;
+	FeatureBuffer scaled(int width, int height) const;
+
+	bool isNull() const { return size() == 0; }
+	bool isMapped() const { return !storeFile.isNull(); }
+	bool isGrayscale() const { return grayscale; }
+	int width() const { return w; }
+	int height() const { return h; }
+	qint64 size() const { return qint64(w) * h; }
+
+	bool contains(const QPoint& pixel) const
+	{
+		return pixel.x() >= 0 && pixel.y() >= 0 && pixel.x() < w && pixel.y() < h;
+	}
+
+	qint64 indexOf(const QPoint& pixel) const { return qint64(pixel.y()) * w + pixel.x(); }
+	QPoint pixelAt(qint64 index) const { return QPoint(index % w, index / w); }
+
+	// channel layout: value, vs * sin(h), vs * cos(h) for color; gray for grayscale
+	const float* valueData() const { return planes[VALUE_PLANE]; }
+	const float* hueSineData() const { return planes[HUE_SINE_PLANE]; }
+	const float* hueCosineData() const { return planes[HUE_COSINE_PLANE]; }
+	const float* grayData() const { return planes[GRAY_PLANE]; }
+
+	static int channelCount(bool useGrayscale) { return useGrayscale ? 1 : 3; }
+	const float* channelData(int channel, bool useGrayscale) const
+	{
+		if (useGrayscale)
+		{
+			return grayData();
+		}
+
+		return channel == 0 ? valueData() : (channel == 1 ? hueSineData() : hueCosineData());
+	}
+
+	double squareDistance(qint64 i1, qint64 i2, bool useGrayscale) const
+	{
+		if (useGrayscale)
+		{
+			double dg = grayData()[i1] - grayData()[i2];
+			return dg * dg;
+		}
+
+		double dv = valueData()[i1] - valueData()[i2];
+		double ds = hueSineData()[i1] - hueSineData()[i2];
+		double dc = hueCosineData()[i1] - hueCosineData()[i2];
+		return dv * dv + ds * ds + dc * dc;
+	}
+
+	Key keyOf(qint64 index, bool useGrayscale) const
+	{
+		if (useGrayscale)
+		{
+			return Key(bitsOf(grayData()[index]), 0);
+		}
+
+		return Key((quint64(bitsOf(valueData()[index])) << 32) | bitsOf(hueSineData()[index]),
+			bitsOf(hueCosineData()[index]));
+	}
+
+private:
+	enum Plane
+	{
+		VALUE_PLANE, HUE_SINE_PLANE, HUE_COSINE_PLANE, GRAY_PLANE, PLANE_COUNT
+	};
+
+	static void convert(const QImage& image, float* const* targetPlanes, qint64 offset);
+	static bool writeStore(const QString& imagePath, const QString& storePath);
+	static FeatureBuffer mapStore(const QString& storePath);
+	void allocate(int width, int height, float** targetPlanes); // in memory
+
+	static quint32 bitsOf(float value)
+	{
+		quint32 bits;
+		std::memcpy(&bits, &value, sizeof(bits));
+		return bits;
+	}
+
+	int w = 0;
+	int h = 0;
+	bool grayscale = false;
+
+	const float* planes[PLANE_COUNT] = {};
+	QVector<float> storage[PLANE_COUNT]; // unless mapped; one vector each, as a Qt 5 container holds at most 2 GiB
+	QSharedPointer<QFile> storeFile; // keeps the mapping alive
+};
+
+#endif // FEATUREBUFFER_H
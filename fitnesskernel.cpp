@@ -0,0 +1,220 @@
+#include "fitnesskernel.h"
+
+#include <QtMath>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define DOSER_X86_KERNELS
+#include <immintrin.h>
+#endif
+
+// scalar fallback
+
+namespace
+{
+	double scalarFitnessFrom(int first, const float* const* channels, int channelCount, const float* query,
+		const double* weights, int count, double weightRatioSquare)
+	{
+		double fitness = 0;
+		for (int j = first; j < count; ++j)
+		{
+			double squareSum = 0;
+			for (int c = 0; c < channelCount; ++c)
+			{
+				double difference = channels[c][j] - query[c];
+				squareSum += difference * difference;
+			}
+
+			fitness += weights[j] * qExp(-squareSum / weightRatioSquare);
+		}
+
+		return fitness;
+	}
+}
+
+double FitnessKernel::scalarFitness(const float* const* channels, int channelCount, const float* query,
+	const double* weights, int count, double weightRatioSquare)
+{
+	return scalarFitnessFrom(0, channels, channelCount, query, weights, count, weightRatioSquare);
+}
+
+#ifdef DOSER_X86_KERNELS
+
+// vectorized kernels
+//
+// exp is approximated on [-87, 0] by range reduction to 2^n * exp(r), |r| <= ln(2) / 2,
+// and a degree 6 polynomial for exp(r) (cephes expf coefficients, rel. error ~1e-7).
+
+namespace
+{
+	const float EXP_LOWER_BOUND = -87.0f;
+	const float LOG2E = 1.44269504088896341f;
+	const float LN2_HI = 0.693359375f;
+	const float LN2_LO = -2.12194440e-4f;
+	const float EXP_P0 = 1.9875691500e-4f;
+	const float EXP_P1 = 1.3981999507e-3f;
+	const float EXP_P2 = 8.3334519073e-3f;
+	const float EXP_P3 = 4.1665795894e-2f;
+	const float EXP_P4 = 1.6666665459e-1f;
+	const float EXP_P5 = 5.0000001201e-1f;
+
+	__attribute__((target("sse2")))
+	inline __m128 exp128(__m128 x)
+	{
+		x = _mm_max_ps(x, _mm_set1_ps(EXP_LOWER_BOUND));
+
+		__m128i n = _mm_cvtps_epi32(_mm_mul_ps(x, _mm_set1_ps(LOG2E)));
+		__m128 fn = _mm_cvtepi32_ps(n);
+		__m128 r = _mm_sub_ps(x, _mm_mul_ps(fn, _mm_set1_ps(LN2_HI)));
+		r = _mm_sub_ps(r, _mm_mul_ps(fn, _mm_set1_ps(LN2_LO)));
+
+		__m128 p = _mm_set1_ps(EXP_P0);
+		p = _mm_add_ps(_mm_mul_ps(p, r), _mm_set1_ps(EXP_P1));
+		p = _mm_add_ps(_mm_mul_ps(p, r), _mm_set1_ps(EXP_P2));
+		p = _mm_add_ps(_mm_mul_ps(p, r), _mm_set1_ps(EXP_P3));
+		p = _mm_add_ps(_mm_mul_ps(p, r), _mm_set1_ps(EXP_P4));
+		p = _mm_add_ps(_mm_mul_ps(p, r), _mm_set1_ps(EXP_P5));
+		p = _mm_add_ps(_mm_mul_ps(_mm_mul_ps(p, r), r), _mm_add_ps(r, _mm_set1_ps(1.0f)));
+
+		__m128i scale = _mm_slli_epi32(_mm_add_epi32(n, _mm_set1_epi32(127)), 23);
+		return _mm_mul_ps(p, _mm_castsi128_ps(scale));
+	}
+
+	__attribute__((target("avx2,fma")))
+	inline __m256 exp256(__m256 x)
+	{
+		x = _mm256_max_ps(x, _mm256_set1_ps(EXP_LOWER_BOUND));
+
+		__m256i n = _mm256_cvtps_epi32(_mm256_mul_ps(x, _mm256_set1_ps(LOG2E)));
+		__m256 fn = _mm256_cvtepi32_ps(n);
+		__m256 r = _mm256_fnmadd_ps(fn, _mm256_set1_ps(LN2_HI), x);
+		r = _mm256_fnmadd_ps(fn, _mm256_set1_ps(LN2_LO), r);
+
+		__m256 p = _mm256_set1_ps(EXP_P0);
+		p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(EXP_P1));
+		p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(EXP_P2));
+		p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(EXP_P3));
+		p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(EXP_P4));
+		p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(EXP_P5));
+		p = _mm256_fmadd_ps(_mm256_mul_ps(p, r), r, _mm256_add_ps(r, _mm256_set1_ps(1.0f)));
+
+		__m256i scale = _mm256_slli_epi32(_mm256_add_epi32(n, _mm256_set1_epi32(127)), 23);
+		return _mm256_mul_ps(p, _mm256_castsi256_ps(scale));
+	}
+
+	__attribute__((target("sse2")))
+	double sse2Fitness(const float* const* channels, int channelCount, const float* query,
+		const double* weights, int count, double weightRatioSquare)
+	{
+		__m128 factor = _mm_set1_ps(static_cast<float>(-1.0 / weightRatioSquare));
+		__m128d lowSum = _mm_setzero_pd();
+		__m128d highSum = _mm_setzero_pd();
+
+		int j = 0;
+		for (; j + 4 <= count; j += 4)
+		{
+			__m128 squareSum = _mm_setzero_ps();
+			for (int c = 0; c < channelCount; ++c)
+			{
+				__m128 difference = _mm_sub_ps(_mm_loadu_ps(channels[c] + j), _mm_set1_ps(query[c]));
+				squareSum = _mm_add_ps(squareSum, _mm_mul_ps(difference, difference));
+			}
+
+			__m128 affinity = exp128(_mm_mul_ps(squareSum, factor));
+			lowSum = _mm_add_pd(lowSum, _mm_mul_pd(_mm_loadu_pd(weights + j), _mm_cvtps_pd(affinity)));
+			highSum = _mm_add_pd(highSum, _mm_mul_pd(_mm_loadu_pd(weights + j + 2),
+				_mm_cvtps_pd(_mm_movehl_ps(affinity, affinity))));
+		}
+
+		double lanes[2];
+		_mm_storeu_pd(lanes, _mm_add_pd(lowSum, highSum));
+
+		return lanes[0] + lanes[1] + scalarFitnessFrom(j, channels, channelCount, query,
+			weights, count, weightRatioSquare);
+	}
+
+	__attribute__((target("avx2,fma")))
+	double avx2Fitness(const float* const* channels, int channelCount, const float* query,
+		const double* weights, int count, double weightRatioSquare)
+	{
+		__m256 factor = _mm256_set1_ps(static_cast<float>(-1.0 / weightRatioSquare));
+		__m256d lowSum = _mm256_setzero_pd();
+		__m256d highSum = _mm256_setzero_pd();
+
+		int j = 0;
+		for (; j + 8 <= count; j += 8)
+		{
+			__m256 squareSum = _mm256_setzero_ps();
+			for (int c = 0; c < channelCount; ++c)
+			{
+				__m256 difference = _mm256_sub_ps(_mm256_loadu_ps(channels[c] + j), _mm256_set1_ps(query[c]));
+				squareSum = _mm256_fmadd_ps(difference, difference, squareSum);
+			}
+
+			__m256 affinity = exp256(_mm256_mul_ps(squareSum, factor));
+			lowSum = _mm256_fmadd_pd(_mm256_loadu_pd(weights + j),
+				_mm256_cvtps_pd(_mm256_castps256_ps128(affinity)), lowSum);
+			highSum = _mm256_fmadd_pd(_mm256_loadu_pd(weights + j + 4),
+				_mm256_cvtps_pd(_mm256_extractf128_ps(affinity, 1)), highSum);
+		}
+
+		double lanes[4];
+		_mm256_storeu_pd(lanes, _mm256_add_pd(lowSum, highSum));
+
+		return lanes[0] + lanes[1] + lanes[2] + lanes[3] + scalarFitnessFrom(j, channels,
+			channelCount, query, weights, count, weightRatioSquare);
+	}
+}
+
+#endif // DOSER_X86_KERNELS
+
+// dispatching
+
+FitnessKernel::InstructionSet FitnessKernel::instructionSet()
+{
+#ifdef DOSER_X86_KERNELS
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+	{
+		return AVX2;
+	}
+	else if (__builtin_cpu_supports("sse2"))
+	{
+		return SSE2;
+	}
+#endif
+
+	return SCALAR;
+}
+
+QString FitnessKernel::toString(InstructionSet instructionSet)
+{
+	switch (instructionSet)
+	{
+	case SSE2:
+		return "SSE2";
+	case AVX2:
+		return "AVX2";
+	default:
+		return "scalar";
+	}
+}
+
+namespace
+{
+	FitnessKernel::Function selectFunction()
+	{
+		switch (FitnessKernel::instructionSet())
+		{
+#ifdef DOSER_X86_KERNELS
+		case FitnessKernel::AVX2:
+			return avx2Fitness;
+		case FitnessKernel::SSE2:
+			return sse2Fitness;
+#endif
+		default:
+			return FitnessKernel::scalarFitness;
+		}
+	}
+}
+
+const FitnessKernel::Function FitnessKernel::function = selectFunction();
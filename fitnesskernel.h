@@ -0,0 +1,36 @@
+#ifndef FITNESSKERNEL_H
+#define FITNESSKERNEL_H
+
+#include <QString>
+
+class FitnessKernel
+{
+public:
+	enum InstructionSet
+	{
+		SCALAR, SSE2, AVX2
+	};
+
+	static const int MAX_CHANNEL_COUNT = 3;
+
+	// sum of weights[j] * exp(-|channels(j) - query|^2 / weightRatioSquare) over 0 <= j < count
+	typedef double (*Function)(const float* const* channels, int channelCount, const float* query,
+		const double* weights, int count, double weightRatioSquare);
+
+	static InstructionSet instructionSet();
+	static QString toString(InstructionSet instructionSet);
+
+	static double fitness(const float* const* channels, int channelCount, const float* query,
+		const double* weights, int count, double weightRatioSquare)
+	{
+		return function(channels, channelCount, query, weights, count, weightRatioSquare);
+	}
+
+	static double scalarFitness(const float* const* channels, int channelCount, const float* query,
+		const double* weights, int count, double weightRatioSquare);
+
+private:
+	static const Function function;
+};
+
+#endif // FITNESSKERNEL_H
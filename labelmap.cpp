@@ -0,0 +1,58 @@
+#include "labelmap.h"
+
+#include <algorithm>
+
+LabelMap::LabelMap(int width, int height) : w(width), h(height), labels(qint64(width) * height, 0)
+{
+}
+
+LabelMap::LabelMap(int width, int height, const QVector<Label>& labels) : w(width), h(height), labels(labels)
+{
+	if (!labels.isEmpty())
+	{
+		maximalLabel = *std::max_element(labels.constBegin(), labels.constEnd());
+	}
+}
+
+QVector<LabelMap::Span> LabelMap::spansOf(const QVector<QPoint>& pixels)
+{
+	QVector<QPoint> sortedPixels(pixels);
+	std::sort(sortedPixels.begin(), sortedPixels.end(), [](const QPoint& p1, const QPoint& p2)
+	{
+		return p1.y() < p2.y() || (p1.y() == p2.y() && p1.x() < p2.x());
+	});
+
+	QVector<Span> spans;
+	for (const QPoint& pixel : sortedPixels)
+	{
+		if (!spans.isEmpty() && spans.last().y == pixel.y()
+			&& spans.last().x + spans.last().length >= pixel.x())
+		{
+			Span& span = spans.last();
+			span.length = qMax(span.length, pixel.x() - span.x + 1);
+		}
+		else
+		{
+			Span span;
+			span.y = pixel.y();
+			span.x = pixel.x();
+			span.length = 1;
+			spans.append(span);
+		}
+	}
+
+	return spans;
+}
+
+void LabelMap::setLabel(const QPoint& pixel, Label label)
+{
+	labels[indexOf(pixel)] = label;
+	maximalLabel = qMax(maximalLabel, label);
+}
+
+void LabelMap::fill(const Span& span, Label label)
+{
+	Label* line = labels.data() + qint64(span.y) * w;
+	std::fill(line + span.x, line + span.x + span.length, label);
+	maximalLabel = qMax(maximalLabel, label);
+}
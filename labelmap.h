@@ -0,0 +1,47 @@
+#ifndef LABELMAP_H
+#define LABELMAP_H
+
+#include <QPoint>
+#include <QVector>
+
+class LabelMap
+{
+public:
+	typedef quint32 Label; // 0 is unlabeled, i + 1 is the ith segment
+
+	struct Span // a horizontal run of pixels
+	{
+		int y = 0;
+		int x = 0;
+		int length = 0;
+	};
+
+	LabelMap() = default;
+	LabelMap(int width, int height);
+	LabelMap(int width, int height, const QVector<Label>& labels); // row by row
+
+	// spans covering the given pixels, row by row
+	static QVector<Span> spansOf(const QVector<QPoint>& pixels);
+
+	bool isNull() const { return labels.isEmpty(); }
+	int width() const { return w; }
+	int height() const { return h; }
+	Label segmentCount() const { return maximalLabel; }
+
+	Label label(const QPoint& pixel) const { return labels.at(indexOf(pixel)); }
+	const Label* constData() const { return labels.constData(); }
+	const Label* constScanLine(int y) const { return labels.constData() + qint64(y) * w; }
+
+	void setLabel(const QPoint& pixel, Label label);
+	void fill(const Span& span, Label label);
+
+private:
+	qint64 indexOf(const QPoint& pixel) const { return qint64(pixel.y()) * w + pixel.x(); }
+
+	int w = 0;
+	int h = 0;
+	Label maximalLabel = 0;
+	QVector<Label> labels; // implicitly shared with the copies handed to clients
+};
+
+#endif // LABELMAP_H
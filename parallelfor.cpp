@@ -0,0 +1,7 @@
+#include "parallelfor.h"
+
+const int ParallelFor::MIN_CHUNK_SIZE;
+const int ParallelFor::MAX_CHUNK_SIZE;
+const int ParallelFor::CHUNKS_PER_WORKER;
+
+thread_local int ParallelFor::threadWorkerLimit = 0;
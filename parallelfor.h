@@ -0,0 +1,97 @@
+#ifndef PARALLELFOR_H
+#define PARALLELFOR_H
+
+#include <QAtomicInt>
+#include <QFuture>
+#include <QThreadPool>
+#include <QtConcurrent/QtConcurrent>
+#include <QVector>
+
+class ParallelFor
+{
+public:
+	static const int MIN_CHUNK_SIZE = 16;
+	static const int MAX_CHUNK_SIZE = 4096;
+	static const int CHUNKS_PER_WORKER = 8;
+
+	// Calls body(begin, end) for consecutive chunks of [0, count) on at most
+	// QThreadPool::globalInstance()->maxThreadCount() workers, or the worker limit of the
+	// calling thread, the calling thread included. progress(done) is invoked on the calling
+	// thread after each of its chunks.
+	template <typename Body, typename Progress>
+	static void run(int count, const Body& body, const Progress& progress, int chunkSize = 0)
+	{
+		if (count <= 0)
+		{
+			return;
+		}
+
+		int workerCount = qMax(1, QThreadPool::globalInstance()->maxThreadCount());
+		if (threadWorkerLimit > 0)
+		{
+			workerCount = qMin(workerCount, threadWorkerLimit);
+		}
+
+		if (chunkSize <= 0)
+		{
+			chunkSize = qBound(MIN_CHUNK_SIZE, count / (workerCount * CHUNKS_PER_WORKER), MAX_CHUNK_SIZE);
+		}
+
+		int chunkCount = (count + chunkSize - 1) / chunkSize;
+		workerCount = qMin(workerCount, chunkCount);
+
+		QAtomicInt nextChunk(0);
+		QAtomicInt doneCount(0);
+		int reportedCount = 0;
+
+		const auto& work = [&](bool isCaller)
+		{
+			int chunk;
+			while ((chunk = nextChunk.fetchAndAddRelaxed(1)) < chunkCount)
+			{
+				int begin = chunk * chunkSize;
+				int end = qMin(begin + chunkSize, count);
+				body(begin, end);
+
+				int done = doneCount.fetchAndAddOrdered(end - begin) + end - begin;
+				if (isCaller)
+				{
+					reportedCount = done;
+					progress(done);
+				}
+			}
+		};
+
+		QVector<QFuture<void>> helpers(workerCount - 1);
+		for (int i = 0; i < helpers.size(); ++i)
+		{
+			helpers[i] = QtConcurrent::run([&]() { work(false); });
+		}
+
+		work(true);
+
+		for (int i = 0; i < helpers.size(); ++i)
+		{
+			helpers[i].waitForFinished();
+		}
+
+		if (reportedCount < count)
+		{
+			progress(count);
+		}
+	}
+
+	template <typename Body>
+	static void run(int count, const Body& body)
+	{
+		run(count, body, [](int) {});
+	}
+
+	// limits the loops run by the calling thread, not those nested in their bodies; 0 lifts it
+	static void setWorkerLimit(int limit) { threadWorkerLimit = limit; }
+
+private:
+	static thread_local int threadWorkerLimit;
+};
+
+#endif // PARALLELFOR_H
@@ -0,0 +1,48 @@
+#include "progressthrottle.h"
+
+#include <QtMath>
+
+void ProgressThrottle::setLimits(double maximalFrequency, double minimalDelta)
+{
+	interval = maximalFrequency > 0 ? 1000 / maximalFrequency : 0;
+	delta = minimalDelta;
+}
+
+void ProgressThrottle::restart()
+{
+	timer.invalidate();
+	lastPercentage = 0;
+	hasPending = false;
+}
+
+bool ProgressThrottle::update(int current, int max)
+{
+	double percentage = max > 0 ? 100.0 * current / max : 100;
+
+	if (!timer.isValid() || current >= max
+		|| (timer.elapsed() >= interval && qAbs(percentage - lastPercentage) >= delta))
+	{
+		timer.start();
+		lastPercentage = percentage;
+		hasPending = false;
+		return true;
+	}
+
+	hasPending = true;
+	pendingCurrent = current;
+	pendingMax = max;
+	return false;
+}
+
+bool ProgressThrottle::takePending(int& current, int& max)
+{
+	if (!hasPending)
+	{
+		return false;
+	}
+
+	current = pendingCurrent;
+	max = pendingMax;
+	hasPending = false;
+	return true;
+}
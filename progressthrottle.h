@@ -0,0 +1,30 @@
+#ifndef PROGRESSTHROTTLE_H
+#define PROGRESSTHROTTLE_H
+
+#include <QElapsedTimer>
+
+class ProgressThrottle
+{
+public:
+	// at most maximalFrequency reports per second (0: unlimited), each at least
+	// minimalDelta percent away from the previous one; completion is always reported
+	void setLimits(double maximalFrequency, double minimalDelta);
+	void restart();
+
+	// returns whether the update is to be reported now; if not, it is kept as pending
+	bool update(int current, int max);
+
+	// returns the last suppressed update, if any, and clears it
+	bool takePending(int& current, int& max);
+
+private:
+	double interval = 0; // ms
+	double delta = 0;
+	QElapsedTimer timer;
+	double lastPercentage = 0;
+	bool hasPending = false;
+	int pendingCurrent = 0;
+	int pendingMax = 0;
+};
+
+#endif // PROGRESSTHROTTLE_H
@@ -0,0 +1,117 @@
+#include "replicatorengine.h"
+
+#include <algorithm>
+
+qint64 ReplicatorEngine::bytes() const
+{
+	return qint64(buffers[0].capacity() + buffers[1].capacity() + columnBuffer.capacity()) * sizeof(double);
+}
+
+void ReplicatorEngine::reset(int size)
+{
+	buffers[0].resize(size);
+	buffers[1].resize(size);
+	if (selectedDynamics == INFECTION_IMMUNIZATION_DYNAMICS)
+	{
+		columnBuffer.resize(size);
+	}
+
+	current = 0;
+	passes = 0;
+	lastResidual = 0;
+}
+
+void ReplicatorEngine::setDynamics(Dynamics dynamics, double selectionStrength)
+{
+	selectedDynamics = dynamics;
+	strength = selectionStrength;
+}
+
+double ReplicatorEngine::replicate(double* f)
+{
+	int n = size();
+	const double* x = buffers[current].constData();
+
+	double overallFitness = 0;
+	for (int i = 0; i < n; ++i)
+	{
+		overallFitness += x[i] * f[i];
+	}
+
+	double sumOfSquares = 0;
+	for (int i = 0; i < n; ++i)
+	{
+		f[i] = x[i] * f[i] / overallFitness;
+
+		double difference = f[i] - x[i];
+		sumOfSquares += difference * difference;
+	}
+
+	return qSqrt(sumOfSquares);
+}
+
+double ReplicatorEngine::replicateExponentially(double* f)
+{
+	// x'(i) = x(i) * exp(k * f(i)) / sum of x(j) * exp(k * f(j)), shifted by the largest fitness
+
+	int n = size();
+	const double* x = buffers[current].constData();
+	double maximalFitness = *std::max_element(f, f + n);
+
+	double sum = 0;
+	for (int i = 0; i < n; ++i)
+	{
+		f[i] = x[i] * qExp(strength * (f[i] - maximalFitness));
+		sum += f[i];
+	}
+
+	double sumOfSquares = 0;
+	for (int i = 0; i < n; ++i)
+	{
+		f[i] /= sum;
+
+		double difference = f[i] - x[i];
+		sumOfSquares += difference * difference;
+	}
+
+	return qSqrt(sumOfSquares);
+}
+
+double ReplicatorEngine::infect(double* payoffs, const double* a, double overallPayoff, int strategy, bool isCoStrategy)
+{
+	// moving towards y, where y - x = c * (e(strategy) - x); the step size maximizes the
+	// average payoff along the way, and it is exact since the payoff is quadratic in the step;
+	// returns |x' - x|
+
+	int n = size();
+	double* x = buffers[current].data();
+
+	double c = isCoStrategy ? x[strategy] / (x[strategy] - 1) : 1;
+	double gradient = c * (payoffs[strategy] - overallPayoff);
+	double curvature = c * c * (a[strategy] - 2 * payoffs[strategy] + overallPayoff);
+
+	double step = curvature >= 0 ? 1 : qMin(1.0, -gradient / curvature);
+	double scale = step * c;
+
+	double previousStrategyWeight = x[strategy];
+	double sumOfSquares = 0;
+	for (int i = 0; i < n; ++i)
+	{
+		double previousWeight = x[i];
+		x[i] = qMax(0.0, (1 - scale) * x[i]);
+		payoffs[i] += scale * (a[i] - payoffs[i]);
+
+		double difference = x[i] - previousWeight;
+		sumOfSquares += difference * difference;
+	}
+
+	double shrunkStrategyWeight = x[strategy];
+	x[strategy] = isCoStrategy && step == 1 ? 0 : qMax(0.0, x[strategy] + scale);
+
+	// the strategy's own change, counted above without the step towards it
+	double shrinkage = shrunkStrategyWeight - previousStrategyWeight;
+	double difference = x[strategy] - previousStrategyWeight;
+	sumOfSquares += difference * difference - shrinkage * shrinkage;
+
+	return qSqrt(qMax(0.0, sumOfSquares));
+}
@@ -0,0 +1,129 @@
+#ifndef REPLICATORENGINE_H
+#define REPLICATORENGINE_H
+
+#include <QtMath>
+#include <QVector>
+
+#include "parallelfor.h"
+
+class ReplicatorEngine
+{
+public:
+	enum Dynamics
+	{
+		REPLICATOR_DYNAMICS, EXPONENTIAL_DYNAMICS, INFECTION_IMMUNIZATION_DYNAMICS
+	};
+
+	int size() const { return buffers[current].size(); }
+	int passCount() const { return passes; }
+	double residual() const { return lastResidual; }
+	qint64 bytes() const;
+
+	// resizes the buffers without giving up their capacity; the weights are left undefined
+	void reset(int size);
+	void setDynamics(Dynamics dynamics, double selectionStrength);
+
+	double* weights() { return buffers[current].data(); }
+	const double* weights() const { return buffers[current].constData(); }
+
+	// Performs one pass of the selected dynamics and returns its residual |x' - x|, so that one
+	// precision means the same for every dynamics; infection-immunization stops moving once no
+	// strategy is infective. fitness(begin, end, x, f) fills f[begin, end) with (Ax)[i];
+	// column(j, a) fills a with the jth column of the symmetric affinity matrix A.
+	template <typename Fitness, typename Column, typename Progress>
+	double iterate(const Fitness& fitness, const Column& column, const Progress& progress);
+
+private:
+	template <typename Fitness, typename Progress>
+	void calculateFitnesses(const Fitness& fitness, const Progress& progress, double* f) const;
+	double replicate(double* f);
+	double replicateExponentially(double* f);
+	double infect(double* payoffs, const double* a, double overallPayoff, int strategy, bool isCoStrategy);
+
+	Dynamics selectedDynamics = REPLICATOR_DYNAMICS;
+	double strength = 1;
+	QVector<double> buffers[2];
+	QVector<double> columnBuffer; // infection-immunization only
+	int current = 0;
+	int passes = 0;
+	double lastResidual = 0;
+};
+
+template <typename Fitness, typename Progress>
+void ReplicatorEngine::calculateFitnesses(const Fitness& fitness, const Progress& progress, double* f) const
+{
+	const double* x = buffers[current].constData();
+	const auto& calculateChunk = [&](int begin, int end)
+	{
+		fitness(begin, end, x, f);
+	};
+
+	ParallelFor::run(size(), calculateChunk, progress);
+}
+
+template <typename Fitness, typename Column, typename Progress>
+double ReplicatorEngine::iterate(const Fitness& fitness, const Column& column, const Progress& progress)
+{
+	// the inactive buffer holds the fitnesses, which become the next weights, except for
+	// infection-immunization, where it keeps the payoffs Ax up to date between passes
+	double* f = buffers[1 - current].data();
+
+	if (selectedDynamics != INFECTION_IMMUNIZATION_DYNAMICS)
+	{
+		calculateFitnesses(fitness, progress, f);
+		lastResidual = selectedDynamics == EXPONENTIAL_DYNAMICS ? replicateExponentially(f) : replicate(f);
+		current = 1 - current;
+		++passes;
+		return lastResidual;
+	}
+
+	if (passes == 0)
+	{
+		calculateFitnesses(fitness, progress, f);
+	}
+
+	// selecting the infective pure strategy or co-strategy
+
+	int n = size();
+	const double* x = buffers[current].constData();
+
+	double overallPayoff = 0;
+	for (int i = 0; i < n; ++i)
+	{
+		overallPayoff += x[i] * f[i];
+	}
+
+	int best = 0;
+	int worst = -1;
+	for (int i = 0; i < n; ++i)
+	{
+		if (f[i] > f[best])
+		{
+			best = i;
+		}
+
+		if (x[i] > 0 && (worst < 0 || f[i] < f[worst]))
+		{
+			worst = i;
+		}
+	}
+
+	double gain = f[best] - overallPayoff;
+	double immunityGain = worst < 0 ? 0 : overallPayoff - f[worst];
+	++passes;
+
+	if (qMax(gain, immunityGain) <= 0)
+	{
+		lastResidual = 0;
+		return 0;
+	}
+
+	bool isCoStrategy = immunityGain > gain;
+	int strategy = isCoStrategy ? worst : best;
+	column(strategy, columnBuffer.data());
+
+	lastResidual = infect(f, columnBuffer.constData(), overallPayoff, strategy, isCoStrategy);
+	return lastResidual;
+}
+
+#endif // REPLICATORENGINE_H
@@ -0,0 +1,207 @@
+#include "sampler.h"
+
+#include <QPointF>
+#include <QtMath>
+#include <QVector>
+
+const int Sampler::COLOR_LEVEL_COUNT;
+const int Sampler::BLUE_NOISE_ATTEMPT_COUNT;
+const double Sampler::BLUE_NOISE_DENSITY = 0.64;
+
+Sampler::Sampler(Strategy strategy, quint32 seed) : strategy(strategy), generator(seed)
+{
+}
+
+QBitArray Sampler::sample(const FeatureBuffer& features, bool useGrayscale, double probability)
+{
+	QBitArray isSampled(features.size(), probability >= 1);
+	if (probability <= 0 || probability >= 1)
+	{
+		return isSampled;
+	}
+
+	switch (strategy)
+	{
+	case GRID_SAMPLING:
+		sampleGrid(features, isSampled, probability);
+		break;
+	case BLUE_NOISE_SAMPLING:
+		sampleBlueNoise(features, isSampled, probability);
+		break;
+	case COLOR_SAMPLING:
+		sampleColors(features, useGrayscale, isSampled, probability);
+		break;
+	default:
+		sampleUniformly(isSampled, probability);
+		break;
+	}
+
+	return isSampled;
+}
+
+// sampling strategies
+
+void Sampler::sampleUniformly(QBitArray& isSampled, double probability)
+{
+	for (int i = 0; i < isSampled.size(); ++i)
+	{
+		if (generator.generateDouble() < probability)
+		{
+			isSampled.setBit(i);
+		}
+	}
+}
+
+void Sampler::sampleGrid(const FeatureBuffer& features, QBitArray& isSampled, double probability)
+{
+	// cells crossing the border keep their full extent, and lose the pixels drawn outside
+	double side = 1 / qSqrt(probability);
+
+	for (int cy = 0; cy * side < features.height(); ++cy)
+	{
+		int top = qFloor(cy * side), height = qMax(1, qFloor((cy + 1) * side) - top);
+		for (int cx = 0; cx * side < features.width(); ++cx)
+		{
+			int left = qFloor(cx * side), width = qMax(1, qFloor((cx + 1) * side) - left);
+			QPoint pixel(left + generator.bounded(width), top + generator.bounded(height));
+
+			if (features.contains(pixel))
+			{
+				isSampled.setBit(features.indexOf(pixel));
+			}
+		}
+	}
+}
+
+void Sampler::sampleBlueNoise(const FeatureBuffer& features, QBitArray& isSampled, double probability)
+{
+	// Bridson's algorithm: candidates in the annulus [radius, 2 radius) around an active sample,
+	// accepted if no sample lies within the radius; a background grid holds at most one sample per cell
+
+	double radius = qSqrt(BLUE_NOISE_DENSITY / probability);
+	if (radius < 1)
+	{
+		sampleGrid(features, isSampled, probability);
+		return;
+	}
+
+	double cellSide = radius / M_SQRT2;
+	int gridWidth = qCeil(features.width() / cellSide), gridHeight = qCeil(features.height() / cellSide);
+	QVector<int> grid(gridWidth * gridHeight, -1);
+	QVector<QPointF> samples;
+	QVector<int> active;
+
+	const auto& accept = [&](const QPointF& point)
+	{
+		grid[int(point.y() / cellSide) * gridWidth + int(point.x() / cellSide)] = samples.size();
+		active.append(samples.size());
+		samples.append(point);
+		isSampled.setBit(features.indexOf(QPoint(int(point.x()), int(point.y()))));
+	};
+
+	const auto& isFree = [&](const QPointF& point)
+	{
+		int cellX = int(point.x() / cellSide), cellY = int(point.y() / cellSide);
+		for (int gy = qMax(0, cellY - 2); gy <= qMin(gridHeight - 1, cellY + 2); ++gy)
+		{
+			for (int gx = qMax(0, cellX - 2); gx <= qMin(gridWidth - 1, cellX + 2); ++gx)
+			{
+				int s = grid.at(gy * gridWidth + gx);
+				if (s >= 0)
+				{
+					const QPointF& difference = samples.at(s) - point;
+					if (difference.x() * difference.x() + difference.y() * difference.y() < radius * radius)
+					{
+						return false;
+					}
+				}
+			}
+		}
+
+		return true;
+	};
+
+	accept(QPointF(generator.bounded(double(features.width())), generator.bounded(double(features.height()))));
+	while (!active.isEmpty())
+	{
+		int a = generator.bounded(active.size());
+		const QPointF center = samples.at(active.at(a));
+		bool isAccepted = false;
+
+		for (int attempt = 0; attempt < BLUE_NOISE_ATTEMPT_COUNT && !isAccepted; ++attempt)
+		{
+			double angle = generator.bounded(2 * M_PI);
+			double distance = radius * (1 + generator.generateDouble());
+			QPointF candidate = center + QPointF(distance * qCos(angle), distance * qSin(angle));
+
+			if (candidate.x() >= 0 && candidate.y() >= 0 && candidate.x() < features.width()
+				&& candidate.y() < features.height() && isFree(candidate))
+			{
+				accept(candidate);
+				isAccepted = true;
+			}
+		}
+
+		if (!isAccepted)
+		{
+			active[a] = active.last();
+			active.removeLast();
+		}
+	}
+}
+
+void Sampler::sampleColors(const FeatureBuffer& features, bool useGrayscale, QBitArray& isSampled, double probability)
+{
+	// the histogram bins quantize every channel to COLOR_LEVEL_COUNT levels; the value and gray
+	// channels range over [0, 1], the hue channels over [-1, 1]
+
+	int channelCount = FeatureBuffer::channelCount(useGrayscale);
+	int binCount = 1;
+	for (int c = 0; c < channelCount; ++c)
+	{
+		binCount *= COLOR_LEVEL_COUNT;
+	}
+
+	QVector<int> bins(features.size());
+	QVector<int> offsets(binCount + 1, 0);
+	for (int i = 0; i < features.size(); ++i)
+	{
+		int bin = 0;
+		for (int c = 0; c < channelCount; ++c)
+		{
+			double value = features.channelData(c, useGrayscale)[i];
+			double normalized = useGrayscale || c == 0 ? value : (value + 1) / 2;
+			bin = bin * COLOR_LEVEL_COUNT + qBound(0, int(normalized * COLOR_LEVEL_COUNT), COLOR_LEVEL_COUNT - 1);
+		}
+
+		bins[i] = bin;
+		++offsets[bin + 1];
+	}
+
+	// grouping the pixels by bin, then drawing from each without replacement
+
+	for (int b = 0; b < binCount; ++b)
+	{
+		offsets[b + 1] += offsets[b];
+	}
+
+	QVector<int> members(features.size());
+	QVector<int> fillCounts(binCount, 0);
+	for (int i = 0; i < features.size(); ++i)
+	{
+		members[offsets[bins[i]] + fillCounts[bins[i]]++] = i;
+	}
+
+	for (int b = 0; b < binCount; ++b)
+	{
+		int* binMembers = members.data() + offsets[b];
+		int memberCount = offsets[b + 1] - offsets[b];
+		int quota = memberCount == 0 ? 0 : qBound(1, qRound(memberCount * probability), memberCount);
+
+		for (int m = 0; m < quota; ++m)
+		{
+			qSwap(binMembers[m], binMembers[m + generator.bounded(memberCount - m)]);
+			isSampled.setBit(binMembers[m]);
+		}
+	}
+}
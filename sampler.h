@@ -0,0 +1,41 @@
+#ifndef SAMPLER_H
+#define SAMPLER_H
+
+#include <QBitArray>
+#include <QRandomGenerator>
+
+#include "featurebuffer.h"
+
+class Sampler
+{
+public:
+	enum Strategy
+	{
+		UNIFORM_SAMPLING, GRID_SAMPLING, BLUE_NOISE_SAMPLING, COLOR_SAMPLING
+	};
+
+	static const int COLOR_LEVEL_COUNT = 8; // per channel, of the color histogram
+	static const int BLUE_NOISE_ATTEMPT_COUNT = 30; // candidates around a sample before it is retired
+	static const double BLUE_NOISE_DENSITY; // samples per square radius of a maximal Poisson-disk set
+
+	// the same strategy and seed reproduce the same sample of the same features
+	Sampler(Strategy strategy, quint32 seed);
+
+	// Marks about probability * features.size() pixels:
+	// uniform - every pixel independently with the probability;
+	// grid - one random pixel in each cell of a grid with cells of 1 / probability pixels;
+	// blue noise - a Poisson-disk set whose radius gives that density, grid if it is below a pixel;
+	// color - the probability within each bin of a color histogram, at least one pixel per bin.
+	QBitArray sample(const FeatureBuffer& features, bool useGrayscale, double probability);
+
+private:
+	void sampleUniformly(QBitArray& isSampled, double probability);
+	void sampleGrid(const FeatureBuffer& features, QBitArray& isSampled, double probability);
+	void sampleBlueNoise(const FeatureBuffer& features, QBitArray& isSampled, double probability);
+	void sampleColors(const FeatureBuffer& features, bool useGrayscale, QBitArray& isSampled, double probability);
+
+	Strategy strategy;
+	QRandomGenerator generator;
+};
+
+#endif // SAMPLER_H
@@ -0,0 +1,132 @@
+#include "segmentview.h"
+
+#include <algorithm>
+#include <QPainter>
+#include <QPaintEvent>
+#include <QRectF>
+
+// constructor
+
+SegmentView::SegmentView(const QString& text, QWidget* parent) : QWidget(parent), placeholder(text)
+{
+}
+
+// content
+
+void SegmentView::setText(const QString& text)
+{
+	placeholder = text;
+	source = QImage();
+	overlay = QImage();
+	updateGeometry();
+	update();
+}
+
+void SegmentView::setImage(const QImage& image, const QSize& labelSize)
+{
+	source = image.convertToFormat(QImage::Format_RGB32);
+	overlay = source;
+	labels = labelSize.isValid() ? labelSize : image.size();
+	updateGeometry();
+	update();
+}
+
+void SegmentView::paintSpans(const QVector<LabelMap::Span>& spans, QRgb color)
+{
+	if (overlay.isNull() || spans.isEmpty())
+	{
+		return;
+	}
+
+	QRect dirtyRect;
+	for (const LabelMap::Span& span : spans)
+	{
+		const QRect& spanRect = toOverlay(span);
+		QRgb* line = reinterpret_cast<QRgb*>(overlay.scanLine(spanRect.y()));
+		std::fill(line + spanRect.left(), line + spanRect.left() + spanRect.width(), color);
+		dirtyRect |= spanRect;
+	}
+
+	update(toWidget(dirtyRect));
+}
+
+void SegmentView::paintLabels(const LabelMap& labelMap, const QVector<QRgb>& palette)
+{
+	if (overlay.isNull())
+	{
+		return;
+	}
+
+	// a preview samples the nearest label of each of its pixels
+
+	bool isPreview = labelMap.width() != overlay.width() || labelMap.height() != overlay.height();
+	for (int y = 0; y < overlay.height(); ++y)
+	{
+		int labelY = isPreview ? qint64(y) * labelMap.height() / overlay.height() : y;
+		const LabelMap::Label* labelLine = labelMap.constScanLine(labelY);
+		const QRgb* sourceLine = reinterpret_cast<const QRgb*>(source.constScanLine(y));
+		QRgb* line = reinterpret_cast<QRgb*>(overlay.scanLine(y));
+
+		for (int x = 0; x < overlay.width(); ++x)
+		{
+			LabelMap::Label label = labelLine[isPreview ? qint64(x) * labelMap.width() / overlay.width() : x];
+			line[x] = label == 0 ? sourceLine[x] : palette[label];
+		}
+	}
+
+	update();
+}
+
+QSize SegmentView::sizeHint() const
+{
+	if (overlay.isNull())
+	{
+		return fontMetrics().size(0, placeholder);
+	}
+
+	return overlay.size();
+}
+
+// painting
+
+void SegmentView::paintEvent(QPaintEvent* event)
+{
+	QPainter painter(this);
+	if (overlay.isNull())
+	{
+		painter.drawText(rect(), Qt::AlignCenter, placeholder);
+		return;
+	}
+
+	// only the exposed part of the scaled image is redrawn
+	QRectF exposed(event->rect());
+	double xScale = overlay.width() / double(width());
+	double yScale = overlay.height() / double(height());
+	QRectF sourceRect(exposed.x() * xScale, exposed.y() * yScale,
+		exposed.width() * xScale, exposed.height() * yScale);
+
+	painter.drawImage(exposed, overlay, sourceRect);
+}
+
+// utility functions
+
+QRect SegmentView::toOverlay(const LabelMap::Span& span) const
+{
+	if (labels == overlay.size())
+	{
+		return QRect(span.x, span.y, span.length, 1);
+	}
+
+	int y = qint64(span.y) * overlay.height() / labels.height();
+	int left = qint64(span.x) * overlay.width() / labels.width();
+	int right = qint64(span.x + span.length) * overlay.width() / labels.width();
+	return QRect(left, y, qMax(1, right - left), 1);
+}
+
+QRect SegmentView::toWidget(const QRect& imageRect) const
+{
+	double xScale = width() / double(overlay.width());
+	double yScale = height() / double(overlay.height());
+	return QRectF(imageRect.x() * xScale, imageRect.y() * yScale,
+		imageRect.width() * xScale, imageRect.height() * yScale).toAlignedRect();
+}
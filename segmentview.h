@@ -0,0 +1,50 @@
+#ifndef SEGMENTVIEW_H
+#define SEGMENTVIEW_H
+
+#include <QImage>
+#include <QRect>
+#include <QSize>
+#include <QString>
+#include <QVector>
+#include <QWidget>
+
+#include "labelmap.h"
+
+class QPaintEvent;
+
+// Shows an image scaled to the widget, with segments painted over it. Painting
+// writes scan lines directly and repaints only the bounding rectangle of the change.
+class SegmentView : public QWidget
+{
+public:
+	explicit SegmentView(const QString& text, QWidget* parent = nullptr);
+
+	bool isNull() const { return overlay.isNull(); }
+	const QImage& image() const { return overlay; } // the source image with the painted segments
+	const QSize& labelSize() const { return labels; } // of the segmented image, image() may be a preview
+
+	void setText(const QString& text);
+	void setImage(const QImage& image, const QSize& labelSize = QSize());
+
+	// colors the spans of a single segment
+	void paintSpans(const QVector<LabelMap::Span>& spans, QRgb color);
+
+	// colors every labeled pixel with palette[label] in a single pass
+	void paintLabels(const LabelMap& labelMap, const QVector<QRgb>& palette);
+
+	QSize sizeHint() const;
+
+protected:
+	void paintEvent(QPaintEvent* event);
+
+private:
+	QRect toOverlay(const LabelMap::Span& span) const;
+	QRect toWidget(const QRect& imageRect) const;
+
+	QString placeholder;
+	QImage source;
+	QImage overlay;
+	QSize labels;
+};
+
+#endif // SEGMENTVIEW_H
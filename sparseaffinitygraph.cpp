@@ -0,0 +1,147 @@
+#include "sparseaffinitygraph.h"
+
+const qint64 SparseAffinityGraph::MAXIMAL_EDGE_COUNT;
+
+qint64 SparseAffinityGraph::bytes() const
+{
+	return qint64(rowOffsets.size()) * sizeof(int) + qint64(columns.size()) * (sizeof(int) + sizeof(float));
+}
+
+void SparseAffinityGraph::clear()
+{
+	n = 0;
+	rowOffsets.clear();
+	rowOffsets.squeeze();
+	columns.clear();
+	columns.squeeze();
+	values.clear();
+	values.squeeze();
+}
+
+void SparseAffinityGraph::assign(QVector<QVector<Entry>>& rows, bool symmetrize)
+{
+	n = rows.size();
+
+	if (symmetrize)
+	{
+		QVector<QVector<Entry>> reverseRows(n);
+		for (int i = 0; i < n; ++i)
+		{
+			for (const Entry& entry : rows[i])
+			{
+				if (entry.first != i)
+				{
+					reverseRows[entry.first].append(Entry(i, entry.second));
+				}
+			}
+		}
+
+		for (int i = 0; i < n; ++i)
+		{
+			rows[i].append(reverseRows[i]);
+			reverseRows[i].clear();
+		}
+	}
+
+	rowOffsets.resize(n + 1);
+	rowOffsets[0] = 0;
+	for (int i = 0; i < n; ++i)
+	{
+		QVector<Entry>& row = rows[i];
+		std::sort(row.begin(), row.end());
+		row.erase(std::unique(row.begin(), row.end(),
+			[](const Entry& e1, const Entry& e2) { return e1.first == e2.first; }), row.end());
+
+		if (rowOffsets[i] + qint64(row.size()) > MAXIMAL_EDGE_COUNT)
+		{
+			throw;
+		}
+
+		rowOffsets[i + 1] = rowOffsets[i] + row.size();
+	}
+
+	columns.resize(rowOffsets[n]);
+	values.resize(rowOffsets[n]);
+	for (int i = 0; i < n; ++i)
+	{
+		int offset = rowOffsets[i];
+		for (const Entry& entry : rows[i])
+		{
+			columns[offset] = entry.first;
+			values[offset] = entry.second;
+			++offset;
+		}
+
+		rows[i].clear();
+	}
+}
+
+void SparseAffinityGraph::compact(const QVector<bool>& keep)
+{
+	QVector<int> newIndices(n, -1);
+	int keptCount = 0;
+	for (int i = 0; i < n; ++i)
+	{
+		if (keep[i])
+		{
+			newIndices[i] = keptCount++;
+		}
+	}
+
+	// entries move towards the front only, so an in-place forward copy is safe
+	int offset = 0;
+	int newRow = 0;
+	for (int i = 0; i < n; ++i)
+	{
+		int begin = rowOffsets[i];
+		int end = rowOffsets[i + 1];
+		if (!keep[i])
+		{
+			continue;
+		}
+
+		rowOffsets[newRow++] = offset;
+		for (int e = begin; e < end; ++e)
+		{
+			int newColumn = newIndices[columns[e]];
+			if (newColumn >= 0)
+			{
+				columns[offset] = newColumn;
+				values[offset] = values[e];
+				++offset;
+			}
+		}
+	}
+
+	rowOffsets[keptCount] = offset;
+	rowOffsets.resize(keptCount + 1);
+	columns.resize(offset);
+	values.resize(offset);
+	n = keptCount;
+}
+
+void SparseAffinityGraph::row(int i, double* y) const
+{
+	std::fill(y, y + n, 0.0);
+	for (int e = rowOffsets[i]; e < rowOffsets[i + 1]; ++e)
+	{
+		y[columns[e]] = values[e];
+	}
+}
+
+void SparseAffinityGraph::multiply(int beginRow, int endRow, const double* x, double* y) const
+{
+	const int* columnData = columns.constData();
+	const float* valueData = values.constData();
+
+	for (int i = beginRow; i < endRow; ++i)
+	{
+		double sum = 0;
+		for (int e = rowOffsets[i]; e < rowOffsets[i + 1]; ++e)
+		{
+			sum += valueData[e] * x[columnData[e]];
+		}
+
+		y[i] = sum;
+	}
+}
@@ -0,0 +1,74 @@
+#ifndef SPARSEAFFINITYGRAPH_H
+#define SPARSEAFFINITYGRAPH_H
+
+#include <algorithm>
+#include <climits>
+#include <QPair>
+#include <QVector>
+
+#include "parallelfor.h"
+
+class SparseAffinityGraph
+{
+public:
+	typedef QPair<int, float> Entry; // column, affinity
+
+	static const qint64 MAXIMAL_EDGE_COUNT = (qint64(INT_MAX) - 64) / sizeof(float); // Qt 5 containers hold at most 2 GiB
+
+	bool isNull() const { return n == 0; }
+	int size() const { return n; }
+	int edgeCount() const { return columns.size(); }
+	qint64 bytes() const;
+
+	// rowFunction(i, row) appends the entries of row i. If maximalRowLength is positive,
+	// only the strongest entries of each row are kept and the graph is symmetrized by union.
+	// The caller keeps the edge count within MAXIMAL_EDGE_COUNT.
+	template <typename RowFunction>
+	void build(int size, const RowFunction& rowFunction, int maximalRowLength = 0);
+	void clear();
+
+	// keeps the nodes i where keep[i] is set, preserving their order
+	void compact(const QVector<bool>& keep);
+
+	// y[i] = sum of A(i, j) * x[j] for beginRow <= i < endRow
+	void multiply(int beginRow, int endRow, const double* x, double* y) const;
+
+	// y[j] = A(i, j) for every j, zero where there is no edge
+	void row(int i, double* y) const;
+
+private:
+	void assign(QVector<QVector<Entry>>& rows, bool symmetrize);
+
+	int n = 0;
+	QVector<int> rowOffsets;
+	QVector<int> columns;
+	QVector<float> values;
+};
+
+template <typename RowFunction>
+void SparseAffinityGraph::build(int size, const RowFunction& rowFunction, int maximalRowLength)
+{
+	QVector<QVector<Entry>> rows(size);
+	QVector<Entry>* rowData = rows.data();
+
+	const auto& buildRows = [&](int begin, int end)
+	{
+		for (int i = begin; i < end; ++i)
+		{
+			QVector<Entry>& row = rowData[i];
+			rowFunction(i, row);
+
+			if (maximalRowLength > 0 && row.size() > maximalRowLength)
+			{
+				std::nth_element(row.begin(), row.begin() + maximalRowLength - 1, row.end(),
+					[](const Entry& e1, const Entry& e2) { return e1.second > e2.second; });
+				row.resize(maximalRowLength);
+			}
+		}
+	};
+
+	ParallelFor::run(size, buildRows);
+	assign(rows, maximalRowLength > 0);
+}
+
+#endif // SPARSEAFFINITYGRAPH_H
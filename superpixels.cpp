@@ -0,0 +1,198 @@
+#include "superpixels.h"
+
+#include <limits>
+#include <QtMath>
+
+#include "parallelfor.h"
+
+const int Superpixels::DEFAULT_ITERATION_COUNT;
+
+void Superpixels::build(const FeatureBuffer& features, bool useGrayscale, int targetCount, double compactness,
+	int iterationCount, const QAtomicInt* cancellation)
+{
+	this->cancellation = cancellation;
+
+	// seeding
+
+	int pixelCount = features.size();
+	double interval = qSqrt(pixelCount / double(qBound(1, targetCount, pixelCount)));
+	gridWidth = qMax(1, qRound(features.width() / interval));
+	gridHeight = qMax(1, qRound(features.height() / interval));
+	cellWidth = features.width() / double(gridWidth);
+	cellHeight = features.height() / double(gridHeight);
+
+	int channelCount = FeatureBuffer::channelCount(useGrayscale);
+	centers.resize(gridWidth * gridHeight);
+	for (int gy = 0; gy < gridHeight; ++gy)
+	{
+		for (int gx = 0; gx < gridWidth; ++gx)
+		{
+			Center& center = centers[gy * gridWidth + gx];
+			center.x = (gx + 0.5) * cellWidth;
+			center.y = (gy + 0.5) * cellHeight;
+
+			int index = features.indexOf(QPoint(int(center.x), int(center.y)));
+			for (int c = 0; c < channelCount; ++c)
+			{
+				center.features[c] = features.channelData(c, useGrayscale)[index];
+			}
+		}
+	}
+
+	// clustering
+
+	labels.resize(pixelCount);
+	for (int i = 0; i < iterationCount && !isCancelled(); ++i)
+	{
+		assign(features, useGrayscale, compactness);
+		if (!isCancelled())
+		{
+			update(features, useGrayscale);
+		}
+	}
+
+	assign(features, useGrayscale, compactness);
+	if (!isCancelled())
+	{
+		selectRepresentatives(features, useGrayscale);
+	}
+}
+
+void Superpixels::assign(const FeatureBuffer& features, bool useGrayscale, double compactness)
+{
+	// centres stay near their grid cell, so only the 3x3 cells around a pixel are searched
+
+	int channelCount = FeatureBuffer::channelCount(useGrayscale);
+	const float* channels[FitnessKernel::MAX_CHANNEL_COUNT];
+	for (int c = 0; c < channelCount; ++c)
+	{
+		channels[c] = features.channelData(c, useGrayscale);
+	}
+
+	double spatialFactor = compactness * compactness / (cellWidth * cellHeight);
+	int* labelData = labels.data();
+
+	const auto& assignRows = [&](int begin, int end)
+	{
+		for (int y = begin; y < end && !isCancelled(); ++y)
+		{
+			int cellY = qMin(int(y / cellHeight), gridHeight - 1);
+			for (int x = 0; x < features.width(); ++x)
+			{
+				int cellX = qMin(int(x / cellWidth), gridWidth - 1);
+				int index = features.indexOf(QPoint(x, y));
+				int nearestCenter = cellY * gridWidth + cellX;
+				double nearestDistance = std::numeric_limits<double>::infinity();
+
+				for (int gy = qMax(0, cellY - 1); gy <= qMin(gridHeight - 1, cellY + 1); ++gy)
+				{
+					for (int gx = qMax(0, cellX - 1); gx <= qMin(gridWidth - 1, cellX + 1); ++gx)
+					{
+						const Center& center = centers.at(gy * gridWidth + gx);
+						double dx = x - center.x, dy = y - center.y;
+						double distance = (dx * dx + dy * dy) * spatialFactor;
+
+						for (int c = 0; c < channelCount; ++c)
+						{
+							double difference = channels[c][index] - center.features[c];
+							distance += difference * difference;
+						}
+
+						if (distance < nearestDistance)
+						{
+							nearestCenter = gy * gridWidth + gx;
+							nearestDistance = distance;
+						}
+					}
+				}
+
+				labelData[index] = nearestCenter;
+			}
+		}
+	};
+
+	ParallelFor::run(features.height(), assignRows);
+}
+
+void Superpixels::update(const FeatureBuffer& features, bool useGrayscale)
+{
+	int channelCount = FeatureBuffer::channelCount(useGrayscale);
+	QVector<Center> sums(centers.size());
+	QVector<int> counts(centers.size(), 0);
+
+	for (int i = 0; i < features.size(); ++i)
+	{
+		Center& sum = sums[labels[i]];
+		const QPoint& pixel = features.pixelAt(i);
+		sum.x += pixel.x();
+		sum.y += pixel.y();
+
+		for (int c = 0; c < channelCount; ++c)
+		{
+			sum.features[c] += features.channelData(c, useGrayscale)[i];
+		}
+
+		++counts[labels[i]];
+	}
+
+	for (int k = 0; k < centers.size(); ++k)
+	{
+		if (counts[k] == 0) // keeps its position for the next assignment
+		{
+			continue;
+		}
+
+		centers[k].x = sums[k].x / counts[k];
+		centers[k].y = sums[k].y / counts[k];
+		for (int c = 0; c < channelCount; ++c)
+		{
+			centers[k].features[c] = sums[k].features[c] / counts[k];
+		}
+	}
+}
+
+void Superpixels::selectRepresentatives(const FeatureBuffer& features, bool useGrayscale)
+{
+	// after update(), the centres hold the mean features of their clusters
+
+	update(features, useGrayscale);
+
+	int channelCount = FeatureBuffer::channelCount(useGrayscale);
+	QVector<int> nearestMembers(centers.size(), -1);
+	QVector<double> nearestDistances(centers.size(), std::numeric_limits<double>::infinity());
+
+	for (int i = 0; i < features.size(); ++i)
+	{
+		int k = labels[i];
+		double distance = 0;
+		for (int c = 0; c < channelCount; ++c)
+		{
+			double difference = features.channelData(c, useGrayscale)[i] - centers[k].features[c];
+			distance += difference * difference;
+		}
+
+		if (distance < nearestDistances[k])
+		{
+			nearestMembers[k] = i;
+			nearestDistances[k] = distance;
+		}
+	}
+
+	// renumbering the non-empty clusters
+
+	QVector<int> clusters(centers.size(), -1);
+	representativeIndices.clear();
+	for (int k = 0; k < centers.size(); ++k)
+	{
+		if (nearestMembers[k] >= 0)
+		{
+			clusters[k] = representativeIndices.size();
+			representativeIndices.append(nearestMembers[k]);
+		}
+	}
+
+	for (int i = 0; i < features.size(); ++i)
+	{
+		labels[i] = clusters[labels[i]];
+	}
+}
@@ -0,0 +1,51 @@
+#ifndef SUPERPIXELS_H
+#define SUPERPIXELS_H
+
+#include <QAtomicInteger>
+#include <QVector>
+
+#include "featurebuffer.h"
+#include "fitnesskernel.h"
+
+class Superpixels
+{
+public:
+	static const int DEFAULT_ITERATION_COUNT = 10;
+
+	// SLIC: about targetCount clusters seeded on a regular grid, each pixel assigned to the
+	// nearest of the centres in the surrounding grid cells; compactness weighs the spatial
+	// distance, in grid intervals, against the feature distance. The build stops within a row
+	// once *cancellation is set, leaving the clusters unusable.
+	void build(const FeatureBuffer& features, bool useGrayscale, int targetCount, double compactness,
+		int iterationCount = DEFAULT_ITERATION_COUNT, const QAtomicInt* cancellation = nullptr);
+
+	int size() const { return representativeIndices.size(); } // non-empty clusters
+	int clusterOf(int index) const { return labels.at(index); }
+
+	// index of the member closest to the mean features of each cluster
+	const QVector<int>& representatives() const { return representativeIndices; }
+
+private:
+	struct Center
+	{
+		double x = 0;
+		double y = 0;
+		double features[FitnessKernel::MAX_CHANNEL_COUNT] = {};
+	};
+
+	bool isCancelled() const { return cancellation && cancellation->load() != 0; }
+	void assign(const FeatureBuffer& features, bool useGrayscale, double compactness);
+	void update(const FeatureBuffer& features, bool useGrayscale);
+	void selectRepresentatives(const FeatureBuffer& features, bool useGrayscale);
+
+	int gridWidth = 0;
+	int gridHeight = 0;
+	double cellWidth = 0;
+	double cellHeight = 0;
+	QVector<Center> centers; // row by row on the grid
+	QVector<int> labels; // center of each pixel, the cluster after build()
+	QVector<int> representativeIndices;
+	const QAtomicInt* cancellation = nullptr;
+};
+
+#endif // SUPERPIXELS_H
@@ -0,0 +1,29 @@
+#include "weightedsegment.h"
+
+void WeightedSegment::append(const QPoint& pixel, double weight)
+{
+	allPixels.append(pixel);
+	if (weight != 0)
+	{
+		weightedMembers.append(Member(pixel, weight));
+	}
+}
+
+void WeightedSegment::normalize()
+{
+	double sumOfWeights = 0;
+	for (const Member& member : weightedMembers)
+	{
+		sumOfWeights += member.second;
+	}
+
+	if (sumOfWeights == 0)
+	{
+		return;
+	}
+
+	for (int i = 0; i < weightedMembers.size(); ++i)
+	{
+		weightedMembers[i].second /= sumOfWeights;
+	}
+}
@@ -0,0 +1,60 @@
+#ifndef WEIGHTEDSEGMENT_H
+#define WEIGHTEDSEGMENT_H
+
+#include <QPair>
+#include <QPoint>
+#include <QVector>
+
+class WeightedSegment
+{
+public:
+	typedef QPair<QPoint, double> Member;
+
+	bool isEmpty() const { return allPixels.isEmpty(); }
+	int size() const { return allPixels.size(); }
+
+	// the first appended pixel
+	const QPoint& referencePixel() const { return allPixels.first(); }
+
+	// pixels with a non-zero weight in the characteristic vector
+	const QVector<Member>& members() const { return weightedMembers; }
+
+	// every pixel of the segment, extrapolated and merged ones included
+	const QVector<QPoint>& pixels() const { return allPixels; }
+
+	// sum of weight(member) * affinity(member, referencePixel), set by the owner
+	double referenceTerm() const { return cachedReferenceTerm; }
+	void setReferenceTerm(double referenceTerm) { cachedReferenceTerm = referenceTerm; }
+
+	void append(const QPoint& pixel, double weight = 0);
+	void normalize();
+
+	// the reference pixel and the weighted members, each pixel mapped by transform(pixel);
+	// the unweighted pixels are dropped and the reference term is left to the owner
+	template <typename Transform>
+	WeightedSegment mapped(const Transform& transform) const;
+
+private:
+	QVector<Member> weightedMembers;
+	QVector<QPoint> allPixels;
+	double cachedReferenceTerm = 0;
+};
+
+template <typename Transform>
+WeightedSegment WeightedSegment::mapped(const Transform& transform) const
+{
+	WeightedSegment segment;
+	if (weightedMembers.isEmpty() || weightedMembers.first().first != referencePixel())
+	{
+		segment.append(transform(referencePixel()));
+	}
+
+	for (const Member& member : weightedMembers)
+	{
+		segment.append(transform(member.first), member.second);
+	}
+
+	return segment;
+}
+
+#endif // WEIGHTEDSEGMENT_H